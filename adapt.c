@@ -19,11 +19,77 @@
 #include "utils.h"
 #include "api_lib.h"
 #include "adapt_impl.h"
+#include "bind_impl.h"
+#include "hbalinux.h"
 
 static struct sa_table adapter_table;
+static struct sa_hash adapter_names;        /* adapters by ad_hba_name */
+static struct sa_hash adapter_hosts;        /* local ports by kernel host */
+static struct sa_arena adapter_arena;       /* adapters, ports and rports */
+static struct sa_intern adapter_strings;    /* names shared by adapters */
 static const u_int32_t adapter_handle_offset = 0x100;
 
-#define HBA_SHORT_NAME_LIMIT    64
+/*
+ * Held by every library call, HBA-API handlers and extensions alike.
+ * Extensions aren't called through the common library, so its lock
+ * doesn't serialize them, and the topology and caches have none of
+ * their own.
+ */
+static pthread_mutex_t adapter_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void
+adapter_lock(void)
+{
+	pthread_mutex_lock(&adapter_mutex);
+}
+
+void
+adapter_unlock(void)
+{
+	pthread_mutex_unlock(&adapter_mutex);
+}
+
+/*
+ * Allocate zeroed memory for a topology object.
+ * Adapters, local ports and remote ports all come from one arena which
+ * is released by adapter_destroy_all(), so they must not be freed.
+ */
+void *
+adapter_alloc(size_t len)
+{
+	return sa_arena_alloc(&adapter_arena, len);
+}
+
+/*
+ * Undo topology allocations back to a mark, for error paths.
+ */
+size_t
+adapter_alloc_mark(void)
+{
+	return sa_arena_mark(&adapter_arena);
+}
+
+void
+adapter_alloc_unwind(size_t mark)
+{
+	sa_arena_unwind(&adapter_arena, mark);
+}
+
+/*
+ * Intern a topology string, returning a handle for adapter_str().
+ * Like the arena, the pool lasts until adapter_destroy_all().
+ */
+u_int32_t
+adapter_intern(const char *str)
+{
+	return sa_intern(&adapter_strings, str);
+}
+
+const char *
+adapter_str(u_int32_t handle)
+{
+	return sa_intern_str(&adapter_strings, handle);
+}
 
 /*
  * Support for adapter information.
@@ -46,8 +112,7 @@ adapter_get_name(HBA_UINT32 index, char *buf)
 	status = HBA_STATUS_ERROR_ILLEGAL_INDEX;
 	ap = sa_table_lookup(&adapter_table, index);
 	if (ap != NULL) {
-		snprintf(buf, HBA_SHORT_NAME_LIMIT,
-			"%s-%u", ap->ad_name, index);
+		strcpy(buf, ap->ad_hba_name);
 		status = HBA_STATUS_OK;
 	}
 	return status;
@@ -59,36 +124,65 @@ adapter_get_name(HBA_UINT32 index, char *buf)
 HBA_STATUS
 adapter_create(struct adapter_info *ap)
 {
+	struct port_info *pp;
+	u_int32_t p;
 	int index;
 
 	index = sa_table_append(&adapter_table, ap);
 	if (index < 0)
 		return HBA_STATUS_ERROR;
 	ap->ad_index = index;
+	sa_table_foreach(&ap->ad_ports, p, pp) {
+		if (sa_hash_insert(&adapter_hosts, pp->ap_kern_hba, pp) < 0)
+			fprintf(stderr, "%s: host index insert failed for "
+				"host%u\n", __func__, pp->ap_kern_hba);
+	}
+	snprintf(ap->ad_hba_name, sizeof(ap->ad_hba_name),
+		 "%s-%u", adapter_str(ap->ad_name), index);
+	if (sa_hash_insert(&adapter_names,
+			   sa_hash_string(ap->ad_hba_name), ap) < 0)
+		fprintf(stderr, "%s: name index insert failed for %s\n",
+			__func__, ap->ad_hba_name);
 	return HBA_STATUS_OK;
 }
 
+static void
+adapter_port_destroy(void *pp_arg, void *arg)
+{
+	struct port_info *pp = pp_arg;
+
+	sa_hash_destroy(&pp->ap_rport_wwpn);
+	sa_hash_destroy(&pp->ap_rport_fcid);
+	sa_hash_destroy(&pp->ap_rport_target);
+	sa_table_destroy(&pp->ap_rport_shadow);
+	sa_hash_destroy(&pp->ap_rports);
+	sa_table_destroy(&pp->ap_rport_list);
+}
+
 void
 adapter_destroy(struct adapter_info *ap)
 {
-	sa_table_destroy_all(&ap->ad_ports);
-	free(ap);
+	sa_table_iterate(&ap->ad_ports, adapter_port_destroy, NULL);
+	sa_table_destroy(&ap->ad_ports);
 }
 
 void
 adapter_destroy_all(void)
 {
 	struct adapter_info *ap;
-	int i;
+	u_int32_t i;
 
-	for (i = 0; i < adapter_table.st_limit; i++) {
-		ap = adapter_table.st_table[i];
-		if (ap) {
-			adapter_table.st_table[i] = NULL;
-			adapter_destroy(ap);
-		}
+	sa_table_foreach(&adapter_table, i, ap) {
+		sa_table_remove(&adapter_table, i);
+		adapter_destroy(ap);
 	}
 	sa_table_destroy(&adapter_table);
+	sa_hash_destroy(&adapter_names);
+	sa_hash_destroy(&adapter_hosts);
+	rport_destroy_all();
+	binding_destroy();
+	sa_arena_release(&adapter_arena);
+	sa_intern_destroy(&adapter_strings);
 }
 
 struct adapter_info *
@@ -98,6 +192,15 @@ adapter_open_handle(HBA_HANDLE handle)
 			       adapter_handle_offset);
 }
 
+/*
+ * Get the local port for a kernel SCSI host number.
+ */
+struct port_info *
+adapter_get_port_by_host(u_int32_t host)
+{
+	return sa_hash_lookup(&adapter_hosts, host);
+}
+
 struct port_info *
 adapter_get_port(HBA_HANDLE handle, HBA_UINT32 port)
 {
@@ -110,103 +213,117 @@ adapter_get_port(HBA_HANDLE handle, HBA_UINT32 port)
 	return pp;
 }
 
-struct port_info *
+struct rport_info *
 adapter_get_rport(HBA_HANDLE handle, HBA_UINT32 port, HBA_UINT32 rport)
 {
 	struct port_info *pp;
-	struct port_info *rp = NULL;
+	struct rport_info *rp = NULL;
 
 	pp = adapter_get_port(handle, port);
 	if (pp) {
 		get_rport_info(pp);
-		rp = sa_table_lookup(&pp->ap_rports, rport);
+		rp = sa_hash_lookup(&pp->ap_rports, rport);
 	}
 	return rp;
 }
 
+static int
+adapter_rport_cmp(const void **ap, const void **bp)
+{
+	const struct rport_info *a = *ap;
+	const struct rport_info *b = *bp;
+
+	if (a->rp_disc_index < b->rp_disc_index)
+		return -1;
+	return a->rp_disc_index > b->rp_disc_index;
+}
+
+/*
+ * Rebuild the compacted list of discovered ports.
+ * The list is in kernel rport number order, so discovered port indexes
+ * stay in the order the kernel assigned the ports.
+ */
+static void
+adapter_rport_list_rebuild(struct port_info *pp)
+{
+	struct sa_table *lp = &pp->ap_rport_list;
+	void *rp;
+	u_int32_t i;
+
+	sa_table_clear(lp);
+	if (sa_table_reserve(lp, pp->ap_rports.sh_count) < 0) {
+		fprintf(stderr, "%s: sa_table_reserve failed\n", __func__);
+		return;
+	}
+	sa_hash_foreach(&pp->ap_rports, i, rp)
+		sa_table_append(lp, rp);
+	sa_table_sort(lp, adapter_rport_cmp);
+	pp->ap_rport_list_stale = 0;
+}
+
+/*
+ * Get the compacted list of discovered ports, up to date.
+ */
+static struct sa_table *
+adapter_rport_list(struct port_info *pp)
+{
+	get_rport_info(pp);
+	if (pp->ap_rport_list_stale)
+		adapter_rport_list_rebuild(pp);
+	return &pp->ap_rport_list;
+}
+
 /*
  * Get the Nth discovered port information.
  */
-struct port_info *
+struct rport_info *
 adapter_get_rport_n(HBA_HANDLE handle, HBA_UINT32 port, HBA_UINT32 n)
 {
 	struct port_info *pp;
-	struct port_info *rp = NULL;
+	struct rport_info *rp = NULL;
 
 	pp = adapter_get_port(handle, port);
-	if (pp) {
-		get_rport_info(pp);
-		rp = sa_table_lookup_n(&pp->ap_rports, n);
-	}
+	if (pp)
+		rp = sa_table_lookup(adapter_rport_list(pp), n);
 	return rp;
 }
 
-static void *
-adapter_target_match(void *rp_arg, void *target_arg)
-{
-	struct port_info *rp = rp_arg;
-
-	if (rp->ap_scsi_target != *(u_int32_t *)target_arg)
-		rp_arg = NULL;
-	return rp_arg;
-}
-
 /*
  * Get the rport by scsi_target number.
  */
-struct port_info *
+struct rport_info *
 adapter_get_rport_target(HBA_HANDLE handle, HBA_UINT32 port, HBA_UINT32 n)
 {
 	struct port_info *pp;
-	struct port_info *rp = NULL;
+	struct rport_info *rp = NULL;
 
 	pp = adapter_get_port(handle, port);
 	if (pp) {
 		get_rport_info(pp);
-		rp = sa_table_search(&pp->ap_rports,
-				     adapter_target_match, &n);
+		rp = sa_hash_lookup(&pp->ap_rport_target, n);
 	}
 	return rp;
 }
 
-static void *
-adapter_wwpn_match(void *rp_arg, void *wwpn_arg)
-{
-	struct port_info *rp = rp_arg;
-
-	if (memcmp(&rp->ap_attr.PortWWN, wwpn_arg, sizeof(HBA_WWN)) != 0)
-		rp_arg = NULL;
-	return rp_arg;
-}
-
-struct port_info *
+struct rport_info *
 adapter_get_rport_by_wwn(struct port_info *pp, HBA_WWN wwpn)
 {
-	struct port_info *rp;
-
 	get_rport_info(pp);
-	rp = sa_table_search(&pp->ap_rports, adapter_wwpn_match, &wwpn);
-	return rp;
+	return sa_hash_lookup(&pp->ap_rport_wwpn, wwn_to_u64(&wwpn));
 }
 
-static void *
-adapter_fcid_match(void *rp_arg, void *fcid_arg)
+struct rport_info *
+adapter_get_rport_by_target(struct port_info *pp, u_int32_t target)
 {
-	struct port_info *rp = rp_arg;
-
-	if (rp->ap_attr.PortFcId != *(fc_fid_t *)fcid_arg)
-		rp_arg = NULL;
-	return rp_arg;
+	get_rport_info(pp);
+	return sa_hash_lookup(&pp->ap_rport_target, target);
 }
 
-struct port_info *
+struct rport_info *
 adapter_get_rport_by_fcid(struct port_info *pp, fc_fid_t fcid)
 {
-	struct port_info *rp;
-
 	get_rport_info(pp);
-	rp = sa_table_search(&pp->ap_rports, adapter_fcid_match, &fcid);
-	return rp;
+	return sa_hash_lookup(&pp->ap_rport_fcid, fcid);
 }
 
 /*
@@ -215,15 +332,23 @@ adapter_get_rport_by_fcid(struct port_info *pp, fc_fid_t fcid)
 HBA_HANDLE
 adapter_open(char *name)
 {
-	char buf[256];
+	struct adapter_info *ap;
 	HBA_HANDLE i;
-	HBA_STATUS status;
 
+	ap = sa_hash_lookup(&adapter_names, sa_hash_string(name));
+	if (ap != NULL && !strcmp(ap->ad_hba_name, name))
+		return adapter_handle_offset + ap->ad_index;
+	if (ap == NULL && adapter_names.sh_count == adapter_table.st_limit)
+		return 0;
+
+	/*
+	 * Not indexed, or hashed the same as another name.
+	 */
 	for (i = 0; i < adapter_table.st_limit; i++) {
-		status = adapter_get_name(i, buf);
-		if (status != HBA_STATUS_OK)
+		ap = adapter_table.st_table[i];
+		if (ap == NULL)
 			return 0;
-		if (!strcmp(buf, name))
+		if (!strcmp(ap->ad_hba_name, name))
 			return adapter_handle_offset + i;
 	}
 	return 0;
@@ -241,15 +366,14 @@ adapter_get_port_by_wwn(HBA_HANDLE handle, HBA_WWN wwn, int *countp)
 	struct adapter_info *ap;
 	struct port_info *pp_found = NULL;
 	struct port_info *pp;
+	fc_wwn_t key = wwn_to_u64(&wwn);
 	int count = 0;
-	int p;
+	u_int32_t p;
 
 	ap = adapter_open_handle(handle);
 	if (ap != NULL) {
-		for (p = 0; p < ap->ad_ports.st_limit; p++) {
-			pp = ap->ad_ports.st_table[p];
-			if (pp &&
-			    !memcmp(&pp->ap_attr.PortWWN, &wwn, sizeof(wwn))) {
+		sa_table_foreach(&ap->ad_ports, p, pp) {
+			if (pp->ap_wwpn == key) {
 				count++;
 				pp_found = pp;
 			}
@@ -271,25 +395,19 @@ adapter_open_by_wwn(HBA_HANDLE *phandle, HBA_WWN wwn)
 	struct adapter_info *ap;
 	struct port_info *pp;
 	HBA_HANDLE found_handle = 0;
+	fc_wwn_t key = wwn_to_u64(&wwn);
 	int count = 0;
 	HBA_STATUS status;
-	int i;
-	int p;
+	u_int32_t i;
+	u_int32_t p;
 
-	for (i = 0; i < adapter_table.st_limit; i++) {
-		ap = adapter_table.st_table[i];
-		if (!ap)
-			continue;
-		if (memcmp(&ap->ad_attr.NodeWWN, &wwn, sizeof(wwn)) == 0) {
+	sa_table_foreach(&adapter_table, i, ap) {
+		if (ap->ad_wwnn == key) {
 			count++;
 			found_handle = ap->ad_index + adapter_handle_offset;
 		} else {
-			for (p = 0; p < ap->ad_ports.st_limit; p++) {
-				pp = ap->ad_ports.st_table[p];
-				if (!pp)
-					continue;
-				if (memcmp(&pp->ap_attr.PortWWN,
-					   &wwn, sizeof(wwn)) == 0) {
+			sa_table_foreach(&ap->ad_ports, p, pp) {
+				if (pp->ap_wwpn == key) {
 					count++;
 					found_handle = ap->ad_index +
 						       adapter_handle_offset;
@@ -318,6 +436,20 @@ adapter_close(HBA_HANDLE handle)
 {
 }
 
+/*
+ * Refresh information for an adapter.
+ * Remote ports and SCSI devices are shared by all adapters, so they are
+ * all rescanned.
+ */
+void
+adapter_refresh(HBA_HANDLE handle)
+{
+	if (adapter_open_handle(handle) != NULL) {
+		rport_refresh();
+		binding_refresh();
+	}
+}
+
 /*
  * Get adapter attributes.
  */
@@ -345,6 +477,7 @@ adapter_get_port_attr(HBA_HANDLE handle, HBA_UINT32 port,
 
 	pp = adapter_get_port(handle, port);
 	if (pp) {
+		pp->ap_attr.NumberofDiscoveredPorts = get_rport_count(pp);
 		*pattr = pp->ap_attr;       /* struct copy */
 		return HBA_STATUS_OK;
 	}
@@ -358,11 +491,11 @@ HBA_STATUS
 adapter_get_rport_attr(HBA_HANDLE handle, HBA_UINT32 port, HBA_UINT32 rport,
 			 HBA_PORTATTRIBUTES *pattr)
 {
-	struct port_info *rp;
+	struct rport_info *rp;
 
 	rp = adapter_get_rport_n(handle, port, rport);
 	if (rp) {
-		*pattr = rp->ap_attr;       /* struct copy */
+		rport_get_attr(rp, pattr);
 		return HBA_STATUS_OK;
 	}
 	return HBA_STATUS_ERROR;
@@ -378,40 +511,148 @@ adapter_get_port_attr_by_wwn(HBA_HANDLE handle, HBA_WWN wwn,
 	struct adapter_info *ap;
 	struct port_info *pp;
 	struct port_info *pp_found = NULL;
+	struct rport_info *rp;
+	struct rport_info *rp_found = NULL;
+	fc_wwn_t key = wwn_to_u64(&wwn);
 	u_int32_t p;
 	int count = 0;
 	HBA_STATUS status;
 
 	ap = adapter_open_handle(handle);
 	if (ap != NULL) {
-		for (p = 0; p < ap->ad_ports.st_limit; p++) {
-			pp = ap->ad_ports.st_table[p];
-			if (pp == NULL)
-				continue;
-			if (!memcmp(&pp->ap_attr.PortWWN, &wwn, sizeof(wwn))) {
+		sa_table_foreach(&ap->ad_ports, p, pp) {
+			if (pp->ap_wwpn == key) {
 				count++;
 				pp_found = pp;
 			}
-			pp = sa_table_search(&pp->ap_rports,
-					     adapter_wwpn_match,
-					     &wwn);
-			if (pp) {
+			rp = sa_hash_lookup(&pp->ap_rport_wwpn, key);
+			if (rp) {
 				count++;
-				pp_found = pp;
+				rp_found = rp;
 			}
 		}
 	}
-	pp = pp_found;
-	if (pp != NULL) {
-		if (count > 1) {
-			status = HBA_STATUS_ERROR_AMBIGUOUS_WWN;
-		} else {
-			*pattr = pp->ap_attr;       /* struct copy */
-			status = HBA_STATUS_OK;
-		}
+	if (count > 1) {
+		status = HBA_STATUS_ERROR_AMBIGUOUS_WWN;
+	} else if (pp_found != NULL) {
+		pp_found->ap_attr.NumberofDiscoveredPorts =
+			get_rport_count(pp_found);
+		*pattr = pp_found->ap_attr;       /* struct copy */
+		status = HBA_STATUS_OK;
+	} else if (rp_found != NULL) {
+		rport_get_attr(rp_found, pattr);
+		status = HBA_STATUS_OK;
 	} else {
 		status = HBA_STATUS_ERROR_ILLEGAL_WWN;
 	}
 	return status;
 }
 
+/*
+ * Find a local port of any adapter by its PortWWN.
+ */
+struct port_info *
+adapter_find_port(HBA_WWN wwn)
+{
+	struct adapter_info *ap;
+	struct port_info *pp;
+	fc_wwn_t key = wwn_to_u64(&wwn);
+	u_int32_t i;
+	u_int32_t p;
+
+	sa_table_foreach(&adapter_table, i, ap)
+		sa_table_foreach(&ap->ad_ports, p, pp)
+			if (pp->ap_wwpn == key)
+				return pp;
+	return NULL;
+}
+
+/*
+ * Return the count of available entries to the caller of an extension
+ * filling an array, and whether they all fit.
+ */
+HBA_STATUS
+adapter_fill_status(HBA_UINT32 *countp, u_int32_t count)
+{
+	HBA_STATUS status = HBA_STATUS_OK;
+
+	if (*countp < count)
+		status = HBA_STATUS_ERROR_MORE_DATA;
+	*countp = count;
+	return status;
+}
+
+/*
+ * Extension: get the lookup fields of all discovered ports of a local port.
+ */
+HBA_STATUS
+hbalinux_get_discovered_ports(HBA_WWN wwn, struct hbalinux_rport *rports,
+			      HBA_UINT32 *countp)
+{
+	struct hbalinux_rport *hp;
+	struct port_info *pp;
+	struct sa_table *lp;
+	struct rport_info *rp;
+	HBA_STATUS status;
+	u_int32_t i;
+
+	adapter_lock();
+	pp = adapter_find_port(wwn);
+	if (pp == NULL) {
+		adapter_unlock();
+		return HBA_STATUS_ERROR_ILLEGAL_WWN;
+	}
+	lp = adapter_rport_list(pp);
+	for (i = 0; i < lp->st_count && i < *countp; i++) {
+		rp = lp->st_table[i];
+		hp = &rports[i];
+		copy_wwn(&hp->PortWWN, rp->rp_wwpn);
+		hp->PortFcId = rp->rp_fcid;
+		hp->PortState = rp->rp_state;
+		hp->ScsiTargetId = rp->rp_scsi_target;
+		hp->DiscoveredPortIndex = i;
+	}
+	status = adapter_fill_status(countp, lp->st_count);
+	adapter_unlock();
+	return status;
+}
+
+/*
+ * Extension: get the attributes of all discovered ports of a local port.
+ */
+HBA_STATUS
+hbalinux_get_discovered_port_attrs(HBA_WWN wwn, HBA_PORTATTRIBUTES *attrs,
+				   HBA_UINT32 *countp)
+{
+	struct port_info *pp;
+	struct sa_table *lp;
+	HBA_STATUS status;
+	u_int32_t i;
+
+	adapter_lock();
+	pp = adapter_find_port(wwn);
+	if (pp == NULL) {
+		adapter_unlock();
+		return HBA_STATUS_ERROR_ILLEGAL_WWN;
+	}
+	lp = adapter_rport_list(pp);
+	for (i = 0; i < lp->st_count && i < *countp; i++)
+		rport_get_attr(lp->st_table[i], &attrs[i]);
+	status = adapter_fill_status(countp, lp->st_count);
+	adapter_unlock();
+	return status;
+}
+
+/*
+ * Extension: report the bytes of adapters, ports and names in use, and
+ * the bytes allocated for them.
+ */
+HBA_STATUS
+hbalinux_get_topology_memory(HBA_UINT64 *in_usep, HBA_UINT64 *allocatedp)
+{
+	adapter_lock();
+	*in_usep = adapter_arena.ar_in_use + adapter_strings.si_len;
+	*allocatedp = adapter_arena.ar_size + adapter_strings.si_size;
+	adapter_unlock();
+	return HBA_STATUS_OK;
+}
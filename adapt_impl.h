@@ -50,6 +50,7 @@ struct hba_info {
 };
 
 #define MAX_DRIVER_NAME_LEN	20
+#define HBA_SHORT_NAME_LIMIT	64
 #define ARRAY_SIZE(a)		(sizeof(a)/sizeof((a)[0]))
 
 HBA_STATUS sysfs_get_port_stats(char *dir, HBA_PORTSTATISTICS *sp);
@@ -71,45 +72,110 @@ extern HBA_STATUS find_pci_device(struct hba_info *);
 struct adapter_info {
     u_int32_t               ad_index;       /* adapter's library index */
     u_int32_t               ad_kern_index;  /* adapter's kernel index */
-    const char              *ad_name;       /* adapter driver name */
+    u_int32_t               ad_name;        /* driver name, adapter_str() */
+    char                    ad_hba_name[HBA_SHORT_NAME_LIMIT]; /* API name */
     struct sa_table         ad_ports;       /* table of ports */
     u_int32_t               ad_port_count;  /* adapter's number of ports */
+    fc_wwn_t                ad_wwnn;        /* ad_attr.NodeWWN as integer */
     HBA_ADAPTERATTRIBUTES   ad_attr;        /* HBA-API attributes */
 };
 
 /*
- * Information about a port on an adapter or a discovered remote port.
+ * Information about a port on an adapter.
  */
 struct port_info {
     struct adapter_info     *ap_adapt;
     u_int32_t               ap_index;
-    u_int32_t               ap_disc_index;  /* discovered port index */
-    u_int32_t               ap_scsi_target; /* SCSI target index (rports) */
-    u_int32_t               ap_kern_hba;    /* kernel HBA index (rports) */
-    struct sa_table         ap_rports;      /* discovered ports */
+    u_int32_t               ap_kern_hba;    /* kernel HBA index */
+    struct sa_hash          ap_rports;      /* rports by kernel number */
+    struct sa_hash          ap_rport_wwpn;  /* rports by PortWWN */
+    struct sa_hash          ap_rport_fcid;  /* rports by PortFcId */
+    struct sa_hash          ap_rport_target; /* rports by SCSI target */
+    struct sa_table         ap_rport_shadow; /* rports hidden by duplicates */
+    struct sa_table         ap_rport_list;  /* ap_rports in number order */
+    int                     ap_rport_list_stale; /* ap_rports changed */
+    fc_wwn_t                ap_wwpn;        /* ap_attr.PortWWN as integer */
+    fc_wwn_t                ap_fabric;      /* ap_attr.FabricName as integer */
     HBA_PORTATTRIBUTES      ap_attr;        /* HBA-API port attributes */
-    char                    host_dir[80];   /* sysfs directory save area */
 };
 
+/*
+ * Information about a discovered remote port.
+ * These are searched often, so only the fields used for lookups are kept
+ * here, with WWNs as integers.  The rest of the HBA-API attributes are in
+ * struct rport_cold, read from /sys on first use, or are derived by
+ * rport_get_attr().
+ */
+struct rport_info {
+    struct adapter_info     *rp_adapt;      /* NULL until attached */
+    fc_wwn_t                rp_wwpn;        /* PortWWN */
+    fc_fid_t                rp_fcid;
+    u_int32_t               rp_scsi_target; /* SCSI target index */
+    u_int32_t               rp_state;       /* HBA_PORTSTATE */
+    u_int32_t               rp_kern_hba;    /* kernel HBA index */
+    u_int32_t               rp_channel;     /* local port (SCSI channel) */
+    u_int32_t               rp_disc_index;  /* kernel rport number */
+    u_int32_t               rp_gen;         /* last scan that saw it */
+    struct rport_cold       *rp_cold;
+};
+
+/*
+ * Remote port attributes not needed for lookups.
+ * Each is read by rport_load() when first needed; rc_valid tells which.
+ */
+struct rport_cold {
+    fc_wwn_t                rc_wwnn;        /* NodeWWN */
+    u_int32_t               rc_maxframe;    /* PortMaxFrameSize */
+    u_int32_t               rc_classes;     /* supported classes */
+    u_int32_t               rc_valid;       /* RPORT_ATTR_* flags */
+};
+
+#define RPORT_ATTR_WWNN         0x01
+#define RPORT_ATTR_MAXFRAME     0x02
+#define RPORT_ATTR_CLASSES      0x04
+#define RPORT_ATTR_ALL          0x07
+
 /*
  * Internal functions.
  */
 HBA_UINT32 adapter_get_count(void);
 HBA_STATUS adapter_get_name(HBA_UINT32 index, char *);
 struct port_info *adapter_get_port_by_wwn(HBA_HANDLE, HBA_WWN, int *countp);
+void adapter_lock(void);
+void adapter_unlock(void);
+void *adapter_alloc(size_t);
+size_t adapter_alloc_mark(void);
+void adapter_alloc_unwind(size_t mark);
+u_int32_t adapter_intern(const char *);
+const char *adapter_str(u_int32_t handle);
 HBA_STATUS adapter_create(struct adapter_info *);
 void adapter_destroy(struct adapter_info *);
 void adapter_destroy_all(void);
 struct adapter_info *adapter_open_handle(HBA_HANDLE);
 struct port_info *adapter_get_port(HBA_HANDLE, HBA_UINT32 port);
-struct port_info *adapter_get_rport(HBA_HANDLE, HBA_UINT32, HBA_UINT32);
-struct port_info *adapter_get_rport_n(HBA_HANDLE, HBA_UINT32, HBA_UINT32);
-struct port_info *adapter_get_rport_target(HBA_HANDLE, HBA_UINT32, HBA_UINT32);
-struct port_info *adapter_get_rport_by_wwn(struct port_info *, HBA_WWN);
-struct port_info *adapter_get_rport_by_fcid(struct port_info *, fc_fid_t);
+struct port_info *adapter_get_port_by_host(u_int32_t host);
+struct rport_info *adapter_get_rport(HBA_HANDLE, HBA_UINT32, HBA_UINT32);
+struct rport_info *adapter_get_rport_n(HBA_HANDLE, HBA_UINT32, HBA_UINT32);
+struct rport_info *adapter_get_rport_target(HBA_HANDLE, HBA_UINT32,
+					     HBA_UINT32);
+struct rport_info *adapter_get_rport_by_wwn(struct port_info *, HBA_WWN);
+struct rport_info *adapter_get_rport_by_target(struct port_info *, u_int32_t);
+struct rport_info *adapter_get_rport_by_fcid(struct port_info *, fc_fid_t);
 void get_rport_info(struct port_info *);
+u_int32_t get_rport_count(struct port_info *);
+void rport_refresh(void);
+u_int32_t rport_prefetch(void);
+void rport_get_attr(struct rport_info *, HBA_PORTATTRIBUTES *);
+void rport_load(struct rport_info *, u_int32_t);
+HBA_STATUS adapter_fill_status(HBA_UINT32 *, u_int32_t);
+struct port_info *adapter_find_port(HBA_WWN);
+void rport_destroy_all(void);
 void sg_get_dev_id(const char *name, char *buf, size_t result_len);
+void sg_pool_forget(const char *);
+void sg_pool_flush(void);
+void sg_pool_destroy(void);
 void copy_wwn(HBA_WWN *dest, fc_wwn_t src);
+fc_wwn_t wwn_to_u64(const HBA_WWN *wwn);
 int is_wwn_nonzero(HBA_WWN *wwn);
 HBA_STATUS sg_issue_read_capacity(const char *, void *, HBA_UINT32 *,
 			HBA_UINT8 *, void *, HBA_UINT32 *);
@@ -122,6 +188,7 @@ HBA_STATUS sg_issue_report_luns(const char *, void *, HBA_UINT32 *,
 HBA_HANDLE adapter_open(char *name);
 HBA_STATUS adapter_open_by_wwn(HBA_HANDLE *, HBA_WWN);
 void adapter_close(HBA_HANDLE);
+void adapter_refresh(HBA_HANDLE);
 HBA_STATUS adapter_get_attr(HBA_HANDLE, HBA_ADAPTERATTRIBUTES *);
 HBA_STATUS adapter_get_port_attr(HBA_HANDLE, HBA_UINT32 port,
 				HBA_PORTATTRIBUTES *);
@@ -20,6 +20,9 @@
 #include "api_lib.h"
 #include "adapt_impl.h"
 #include "bind_impl.h"
+#include "fc_scsi.h"
+#include "hbalinux.h"
+#include "uevent_impl.h"
 
 /*
  * Binding capabilities we understand.
@@ -29,6 +32,17 @@
 				HBA_CAN_BIND_TO_WWNN)
 #define SYSFS_BIND		"tgtid_bind_type"
 
+/*
+ * Limits for getting LUIDs for a target mapping.  Each LUID is an
+ * INQUIRY which may take the full SG_IO timeout on a slow target.
+ */
+#define LUID_THREADS            16      /* INQUIRYs in flight in all */
+#define LUID_TARGET_LIMIT       4       /* INQUIRYs in flight per target */
+#define LUID_DEADLINE           30      /* seconds to start INQUIRYs */
+#define LUID_REPORT_LUNS        8       /* failed LUNs named per target */
+
+#define BINDING_DEV_LEN         (sizeof("/dev/") - 1 + UEVENT_NAME_LEN)
+
 /*
  * Name-value strings for kernel bindings.
  * The first word of the strings must exactly match those in
@@ -42,11 +56,45 @@ static struct sa_nameval binding_types_table[] = {
 	{ NULL,                             0 }
 };
 
+/*
+ * A LUID to get for a target mapping entry.
+ */
+struct binding_luid {
+	HBA_LUID              *lj_luid;
+	struct binding_lun    *lj_cache;    /* where to keep it, or NULL */
+	u_int32_t             lj_target;    /* index in binding_luids */
+	u_int32_t             lj_hba;
+	u_int32_t             lj_port;
+	u_int32_t             lj_tgt;
+	u_int32_t             lj_lun;
+	int                   lj_state;     /* LUID_* */
+	char                  lj_sg[32];    /* SCSI-generic dev name */
+};
+
+#define LUID_WAITING    0
+#define LUID_STARTED    1
+#define LUID_DONE       2
+
+/*
+ * LUIDs to get for a target mapping, and the workers getting them.
+ */
+struct binding_luids {
+	struct binding_luid   *bl_jobs;
+	u_int32_t             bl_count;
+	u_int32_t             bl_size;
+	u_int32_t             bl_next;      /* first job maybe waiting */
+	u_int32_t             *bl_in_flight; /* per target */
+	struct sa_hash        bl_targets;   /* target index + 1 by H:C:T */
+	u_int32_t             bl_target_count;
+	struct timespec       bl_deadline;
+	pthread_mutex_t       bl_lock;
+	pthread_cond_t        bl_cond;
+};
+
 /*
  * Context for LUN binding reader.
  */
 struct binding_context {
-	HBA_HANDLE            oc_handle;
 	int                   oc_kern_hba;  /* kernel HBA number */
 	int                   oc_port;
 	int                   oc_target;
@@ -58,10 +106,479 @@ struct binding_context {
 	HBA_STATUS            oc_status;
 	char                  oc_sg[32];    /* SCSI-generic dev name */
 	HBA_SCSIID            *oc_scp;      /* place for OS device name */
-	struct port_info      *oc_rport;    /* target remote port, if known */
 	char                  oc_path[256]; /* parent dir save area */
+	struct binding_luids  *oc_luids;    /* LUIDs to get after the read */
+	struct binding_keys   *oc_keys;     /* only list the SCSI devices */
+};
+
+/*
+ * SCSI devices listed for the warm-up thread, by binding_lun_key().
+ */
+struct binding_keys {
+	u_int64_t             *bk_keys;
+	u_int32_t             bk_count;
+	u_int32_t             bk_size;
+};
+
+/*
+ * A SCSI device by H:C:T:L, with its device names, so SCSI passthrough
+ * can find its sg device without reading /sys each time.
+ * Its LUID and standard INQUIRY data are kept once gotten, since they
+ * seldom change.  They are dropped if the device names change on a
+ * re-read, or the device reports its inquiry data changed.
+ */
+struct binding_lun {
+	u_int32_t             bl_generation; /* binding_generation when read */
+	u_int32_t             bl_flags;     /* BINDING_LUN_* */
+	char                  bl_sg[BINDING_DEV_LEN];    /* SCSI-generic dev */
+	char                  bl_block[BINDING_DEV_LEN]; /* block dev */
+	char                  bl_luid[sizeof(((HBA_LUID *) 0)->buffer)];
+	u_int32_t             bl_inq_len;   /* standard INQUIRY length */
+	u_int32_t             bl_inq_gen;   /* binding_generation of bl_inq */
+	u_int8_t              bl_inq[255];  /* standard INQUIRY data */
 };
 
+#define BINDING_LUN_LUID        0x01    /* bl_luid is set */
+#define BINDING_LUN_INQ         0x02    /* bl_inq is set */
+#define BINDING_LUN_INQ_ALL     0x04    /* bl_inq is all there is */
+
+/*
+ * Entries read before the last binding_refresh() are read again when
+ * next looked up.
+ */
+static struct sa_hash binding_luns;     /* binding_lun by binding_lun_key() */
+static u_int32_t binding_generation = 1;
+
+/*
+ * A SCSI device read ahead by the warm-up thread, with its LUID and
+ * standard INQUIRY data.  It's taken into the index by the next library
+ * call using it, unless the index may have changed since it was read.
+ */
+struct binding_warm {
+	u_int64_t             bw_key;
+	u_int32_t             bw_seq;       /* binding_warm_seq when read */
+	struct binding_lun    bw_lun;
+};
+
+static pthread_mutex_t binding_warm_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sa_table binding_warm;    /* binding_warm not yet taken */
+static u_int32_t binding_warm_seq;      /* bumped on refresh or uevents */
+
+/*
+ * Targets with LUIDs that couldn't be gotten, by binding_luid_key(), with
+ * the binding_generation they were reported in.  Failed LUIDs aren't
+ * kept, so they're tried again by every mapping; each target is only
+ * reported once per refresh.
+ */
+static struct sa_hash binding_luid_failed;
+
+static int get_binding_os_names(struct dirent *, void *);
+
+/*
+ * Make the index key for an H:C:T:L.
+ * Returns -1 if a number is too big to pack, and the device isn't indexed.
+ */
+static int
+binding_lun_key(u_int32_t hba, u_int32_t channel, u_int32_t target,
+		u_int32_t lun, u_int64_t *keyp)
+{
+	if (hba > 0xffff || channel > 0xff || target > 0xffff ||
+	    lun > 0xffffff)
+		return -1;
+	*keyp = ((u_int64_t) hba << 48) | ((u_int64_t) channel << 40) |
+		((u_int64_t) target << 24) | lun;
+	return 0;
+}
+
+static void
+binding_lun_unkey(u_int64_t key, u_int32_t *hbap, u_int32_t *channelp,
+		  u_int32_t *targetp, u_int32_t *lunp)
+{
+	*hbap = key >> 48;
+	*channelp = (key >> 40) & 0xff;
+	*targetp = (key >> 24) & 0xffff;
+	*lunp = key & 0xffffff;
+}
+
+/*
+ * Read the device names of a SCSI device from its own directory.
+ * This is one directory read whatever the number of SCSI devices.
+ * Returns non-zero if there is no such device.
+ */
+static int
+binding_lun_read(u_int32_t hba, u_int32_t channel, u_int32_t target,
+		 u_int32_t lun, struct binding_lun *bp)
+{
+	struct binding_context ctxt;
+	HBA_SCSIID scsi_id;
+	int rc;
+
+	memset(&ctxt, 0, sizeof(ctxt));
+	memset(&scsi_id, 0, sizeof(scsi_id));
+	ctxt.oc_scp = &scsi_id;
+	snprintf(ctxt.oc_path, sizeof(ctxt.oc_path),
+		 SYSFS_LUN_DIR "/%u:%u:%u:%u/device",
+		 hba, channel, target, lun);
+	rc = sa_dir_read(ctxt.oc_path, get_binding_os_names, &ctxt);
+	if (rc != 0)
+		return rc;
+	if (strncmp(bp->bl_sg, ctxt.oc_sg, sizeof(bp->bl_sg)) ||
+	    strncmp(bp->bl_block, scsi_id.OSDeviceName, sizeof(bp->bl_block)))
+		bp->bl_flags = 0;       /* maybe not the same device */
+	sa_strncpy_safe(bp->bl_sg, sizeof(bp->bl_sg),
+			ctxt.oc_sg, sizeof(ctxt.oc_sg));
+	sa_strncpy_safe(bp->bl_block, sizeof(bp->bl_block),
+			scsi_id.OSDeviceName, sizeof(scsi_id.OSDeviceName));
+	return 0;
+}
+
+static void
+binding_lun_clear(void)
+{
+	struct binding_lun *bp;
+	u_int32_t i;
+
+	sa_hash_foreach(&binding_luns, i, bp)
+		free(bp);
+	sa_hash_destroy(&binding_luns);
+}
+
+/*
+ * Find a SCSI device by H:C:T:L.
+ * Devices not in the index, or read before the last refresh, are read
+ * directly.  Devices too big to index are read into *bufp and not kept.
+ */
+static struct binding_lun *
+binding_lun_lookup(u_int32_t hba, u_int32_t channel, u_int32_t target,
+		   u_int32_t lun, struct binding_lun *bufp)
+{
+	struct binding_lun *bp;
+	u_int64_t key;
+
+	if (binding_lun_key(hba, channel, target, lun, &key) != 0) {
+		memset(bufp, 0, sizeof(*bufp));
+		if (binding_lun_read(hba, channel, target, lun, bufp) != 0)
+			return NULL;
+		bufp->bl_generation = binding_generation;
+		return bufp;
+	}
+	bp = sa_hash_lookup(&binding_luns, key);
+	if (bp != NULL && bp->bl_generation == binding_generation)
+		return bp;
+	if (bp == NULL) {
+		bp = malloc(sizeof(*bp));
+		if (bp == NULL)
+			return NULL;
+		memset(bp, 0, sizeof(*bp));
+		if (sa_hash_insert(&binding_luns, key, bp) < 0) {
+			free(bp);
+			return NULL;
+		}
+	}
+	if (binding_lun_read(hba, channel, target, lun, bp) != 0) {
+		sa_hash_remove(&binding_luns, key);
+		free(bp);
+		bp = NULL;
+	} else {
+		bp->bl_generation = binding_generation;
+	}
+	return bp;
+}
+
+/*
+ * Put a SCSI device read ahead into the index.
+ * An entry read since is kept, but gets the LUID and INQUIRY data it
+ * lacks if it's still the same device.
+ */
+static void
+binding_warm_apply(struct binding_warm *wp)
+{
+	struct binding_lun *wlp = &wp->bw_lun;
+	struct binding_lun *bp;
+
+	bp = sa_hash_lookup(&binding_luns, wp->bw_key);
+	if (bp != NULL && bp->bl_generation == binding_generation) {
+		if (strcmp(bp->bl_sg, wlp->bl_sg) ||
+		    strcmp(bp->bl_block, wlp->bl_block))
+			return;
+		if (!(bp->bl_flags & BINDING_LUN_LUID) &&
+		    (wlp->bl_flags & BINDING_LUN_LUID)) {
+			memcpy(bp->bl_luid, wlp->bl_luid, sizeof(bp->bl_luid));
+			bp->bl_flags |= BINDING_LUN_LUID;
+		}
+		if (!(bp->bl_flags & BINDING_LUN_INQ) &&
+		    (wlp->bl_flags & BINDING_LUN_INQ)) {
+			memcpy(bp->bl_inq, wlp->bl_inq, wlp->bl_inq_len);
+			bp->bl_inq_len = wlp->bl_inq_len;
+			bp->bl_inq_gen = binding_generation;
+			bp->bl_flags |= wlp->bl_flags &
+				(BINDING_LUN_INQ | BINDING_LUN_INQ_ALL);
+		}
+		return;
+	}
+	if (bp == NULL) {
+		bp = malloc(sizeof(*bp));
+		if (bp == NULL)
+			return;
+		if (sa_hash_insert(&binding_luns, wp->bw_key, bp) < 0) {
+			free(bp);
+			return;
+		}
+	}
+	*bp = *wlp;
+	bp->bl_generation = binding_generation;
+	bp->bl_inq_gen = binding_generation;
+}
+
+/*
+ * Take the SCSI devices read ahead since the last call.
+ */
+static void
+binding_warm_take(void)
+{
+	struct binding_warm *wp;
+
+	pthread_mutex_lock(&binding_warm_lock);
+	while ((wp = sa_table_pop(&binding_warm)) != NULL) {
+		if (wp->bw_seq == binding_warm_seq)
+			binding_warm_apply(wp);
+		free(wp);
+	}
+	pthread_mutex_unlock(&binding_warm_lock);
+}
+
+/*
+ * Mark SCSI devices being read ahead as possibly out of date.
+ */
+static void
+binding_warm_stale(void)
+{
+	pthread_mutex_lock(&binding_warm_lock);
+	binding_warm_seq++;
+	pthread_mutex_unlock(&binding_warm_lock);
+}
+
+/*
+ * Apply a uevent to the SCSI device index.
+ * Added and removed SCSI devices are marked to be re-read when next
+ * looked up, which is a read of their own directory; sg and block
+ * device names are changed in place.  Entries aren't freed here, since
+ * a target mapping may be holding them.
+ */
+static void
+binding_uevent(const struct uevent *up)
+{
+	struct binding_lun *bp;
+	u_int64_t key;
+	char *name;
+	size_t len;
+	char dev[BINDING_DEV_LEN];
+
+	if (up->ue_action == UEVENT_ACT_LOST) {
+		binding_refresh();
+		return;
+	}
+	if (up->ue_subsys == UEVENT_SUB_SCSI_GENERIC &&
+	    up->ue_action == UEVENT_ACT_REMOVE) {
+		snprintf(dev, sizeof(dev), "/dev/%s", up->ue_name);
+		sg_pool_forget(dev);
+	}
+	if (binding_lun_key(up->ue_hba, up->ue_channel, up->ue_target,
+			    up->ue_lun, &key) != 0)
+		return;
+	bp = sa_hash_lookup(&binding_luns, key);
+	if (bp == NULL)
+		return;                 /* read when first looked up */
+
+	switch (up->ue_subsys) {
+	case UEVENT_SUB_SCSI_DEVICE:
+		if (up->ue_action != UEVENT_ACT_CHANGE) {
+			bp->bl_generation = 0;
+			bp->bl_flags = 0;
+		} else if (up->ue_inq_changed) {
+			bp->bl_flags = 0;
+		}
+		return;
+	case UEVENT_SUB_SCSI_GENERIC:
+		name = bp->bl_sg;
+		len = sizeof(bp->bl_sg);
+		break;
+	case UEVENT_SUB_BLOCK:
+		name = bp->bl_block;
+		len = sizeof(bp->bl_block);
+		break;
+	default:
+		return;
+	}
+	if (up->ue_action == UEVENT_ACT_ADD)
+		snprintf(name, len, "/dev/%s", up->ue_name);
+	else if (up->ue_action == UEVENT_ACT_REMOVE)
+		name[0] = '\0';
+}
+
+/*
+ * Apply the SCSI devices read ahead and the uevents queued since the
+ * last call.  Read-aheads go first, so any uevent for them is applied.
+ */
+static void
+binding_uevents(void)
+{
+	struct uevent event;
+	int seen = 0;
+
+	binding_warm_take();
+	while (uevent_next(&event)) {
+		binding_uevent(&event);
+		seen = 1;
+	}
+	if (seen)
+		binding_warm_stale();
+}
+
+/*
+ * Find the SCSI device for a LUN of a discovered port.
+ */
+static struct binding_lun *
+binding_lun_find(struct port_info *lp, HBA_WWN disc_wwpn, HBA_UINT64 fc_lun,
+		 struct binding_lun *bufp)
+{
+	struct rport_info *rp;
+
+	binding_uevents();
+	rp = adapter_get_rport_by_wwn(lp, disc_wwpn);
+	if (rp == NULL || rp->rp_scsi_target == -1)
+		return NULL;
+	return binding_lun_lookup(rp->rp_kern_hba, rp->rp_channel,
+				  rp->rp_scsi_target, (u_int32_t) fc_lun,
+				  bufp);
+}
+
+/*
+ * Get kept standard INQUIRY data for a LUN.
+ * Data is only trusted while uevents are being read, which is how a
+ * removed device or changed inquiry data would be seen, and if it was
+ * read since the last refresh.
+ * Returns 0 if there's enough to fill *lenp bytes, or all there is, and
+ * sets *lenp to the length copied.
+ */
+int
+binding_get_inquiry(struct port_info *lp, HBA_WWN disc_wwpn,
+		    HBA_UINT64 fc_lun, void *buf, HBA_UINT32 *lenp)
+{
+	struct binding_lun lun_buf;
+	struct binding_lun *bp;
+	HBA_UINT32 len = *lenp;
+
+	if (!uevent_active())
+		return ENOENT;
+	bp = binding_lun_find(lp, disc_wwpn, fc_lun, &lun_buf);
+	if (bp == NULL || !(bp->bl_flags & BINDING_LUN_INQ) ||
+	    bp->bl_inq_gen != binding_generation)
+		return ENOENT;
+	if (len > bp->bl_inq_len) {
+		if (!(bp->bl_flags & BINDING_LUN_INQ_ALL))
+			return ENOENT;
+		len = bp->bl_inq_len;
+	}
+	memcpy(buf, bp->bl_inq, len);
+	*lenp = len;
+	return 0;
+}
+
+/*
+ * Keep standard INQUIRY data read from a LUN.
+ * If fewer bytes came back than were asked for, that's all there is.
+ */
+void
+binding_put_inquiry(struct port_info *lp, HBA_WWN disc_wwpn,
+		    HBA_UINT64 fc_lun, const void *buf,
+		    HBA_UINT32 asked, HBA_UINT32 len)
+{
+	struct binding_lun lun_buf;
+	struct binding_lun *bp;
+
+	bp = binding_lun_find(lp, disc_wwpn, fc_lun, &lun_buf);
+	if (bp == NULL || bp == &lun_buf || len > sizeof(bp->bl_inq) ||
+	    ((bp->bl_flags & BINDING_LUN_INQ) &&
+	     bp->bl_inq_gen == binding_generation && len <= bp->bl_inq_len))
+		return;
+	memcpy(bp->bl_inq, buf, len);
+	bp->bl_inq_len = len;
+	bp->bl_inq_gen = binding_generation;
+	bp->bl_flags |= BINDING_LUN_INQ;
+	if (len < asked && len < sizeof(bp->bl_inq))
+		bp->bl_flags |= BINDING_LUN_INQ_ALL;
+	else
+		bp->bl_flags &= ~BINDING_LUN_INQ_ALL;
+}
+
+/*
+ * Drop kept LUID and INQUIRY data of a LUN reporting its inquiry data
+ * changed, in fixed or descriptor format sense data.
+ */
+void
+binding_check_sense(struct port_info *lp, HBA_WWN disc_wwpn,
+		    HBA_UINT64 fc_lun, const void *sense, HBA_UINT32 len)
+{
+	const u_int8_t *sp = sense;
+	struct binding_lun lun_buf;
+	struct binding_lun *bp;
+	u_int32_t key;
+	u_int32_t asc;
+
+	if (len < 4)
+		return;
+	switch (sp[0] & 0x7f) {
+	case 0x70:
+	case 0x71:
+		if (len < 14)
+			return;
+		key = sp[2] & 0xf;
+		asc = (sp[12] << 8) | sp[13];
+		break;
+	case 0x72:
+	case 0x73:
+		key = sp[1] & 0xf;
+		asc = (sp[2] << 8) | sp[3];
+		break;
+	default:
+		return;
+	}
+	if (key != SCSI_SK_UNIT_ATTN || asc != SCSI_ASC_INQ_CHANGED)
+		return;
+	bp = binding_lun_find(lp, disc_wwpn, fc_lun, &lun_buf);
+	if (bp != NULL)
+		bp->bl_flags = 0;
+}
+
+/*
+ * Have indexed SCSI devices re-read on their next use, and sg devices
+ * opened again.
+ */
+void
+binding_refresh(void)
+{
+	binding_generation++;
+	binding_warm_stale();
+	sg_pool_flush();
+}
+
+static void binding_map_destroy(void);
+
+void
+binding_destroy(void)
+{
+	struct binding_warm *wp;
+
+	while ((wp = sa_table_pop(&binding_warm)) != NULL)
+		free(wp);
+	sa_table_destroy(&binding_warm);
+	binding_lun_clear();
+	binding_map_destroy();
+	sa_hash_destroy(&binding_luid_failed);
+	sg_pool_destroy();
+}
+
 /*
  * Get binding capability.
  * We currently don't have a way to get this from the driver.
@@ -189,17 +706,304 @@ get_binding_os_names(struct dirent *dp, void *arg)
 	return 0;
 }
 
+/*
+ * Keep a LUID gotten for a SCSI device.
+ */
+static void
+binding_luid_keep(struct binding_lun *bp, HBA_LUID *luid)
+{
+	if (bp == NULL || luid->buffer[0] == 0)
+		return;
+	memcpy(bp->bl_luid, luid->buffer, sizeof(bp->bl_luid));
+	bp->bl_flags |= BINDING_LUN_LUID;
+}
+
+static inline u_int64_t
+binding_luid_key(u_int32_t hba, u_int32_t port, u_int32_t tgt)
+{
+	return ((u_int64_t) hba << 48) ^ ((u_int64_t) port << 32) ^ tgt;
+}
+
+/*
+ * Queue a LUID to get once the SCSI devices have been read.
+ * If it can't be queued, it's gotten now.
+ */
+static void
+binding_luid_add(struct binding_luids *lp, HBA_LUID *luid,
+		 struct binding_lun *bp, const char *sg,
+		 u_int32_t hba, u_int32_t port, u_int32_t tgt, u_int32_t lun)
+{
+	struct binding_luid *jp;
+	u_int64_t key;
+	u_int32_t size;
+	void *ip;
+
+	if (lp == NULL)
+		goto now;
+	if (lp->bl_count >= lp->bl_size) {
+		size = lp->bl_size ? lp->bl_size * 2 : 64;
+		jp = realloc(lp->bl_jobs, size * sizeof(*jp));
+		if (jp == NULL)
+			goto now;
+		lp->bl_jobs = jp;
+		lp->bl_size = size;
+	}
+	key = binding_luid_key(hba, port, tgt);
+	ip = sa_hash_lookup(&lp->bl_targets, key);
+	if (ip == NULL) {
+		ip = (void *) (uintptr_t) ++lp->bl_target_count;
+		if (sa_hash_insert(&lp->bl_targets, key, ip) < 0) {
+			lp->bl_target_count--;
+			goto now;
+		}
+	}
+	jp = &lp->bl_jobs[lp->bl_count++];
+	memset(jp, 0, sizeof(*jp));
+	jp->lj_luid = luid;
+	jp->lj_cache = bp;
+	jp->lj_target = (uintptr_t) ip - 1;
+	jp->lj_hba = hba;
+	jp->lj_port = port;
+	jp->lj_tgt = tgt;
+	jp->lj_lun = lun;
+	sa_strncpy_safe(jp->lj_sg, sizeof(jp->lj_sg), sg, strlen(sg) + 1);
+	return;
+now:
+	sg_get_dev_id(sg, luid->buffer, sizeof(luid->buffer));
+	binding_luid_keep(bp, luid);
+}
+
+/*
+ * Take the next LUID to get whose target isn't at its in-flight limit.
+ * Called with bl_lock held.
+ */
+static struct binding_luid *
+binding_luid_next(struct binding_luids *lp, int *waitingp)
+{
+	struct binding_luid *jp;
+	u_int32_t i;
+
+	*waitingp = 0;
+	while (lp->bl_next < lp->bl_count &&
+	       lp->bl_jobs[lp->bl_next].lj_state != LUID_WAITING)
+		lp->bl_next++;
+	for (i = lp->bl_next; i < lp->bl_count; i++) {
+		jp = &lp->bl_jobs[i];
+		if (jp->lj_state != LUID_WAITING)
+			continue;
+		if (lp->bl_in_flight[jp->lj_target] < LUID_TARGET_LIMIT) {
+			jp->lj_state = LUID_STARTED;
+			lp->bl_in_flight[jp->lj_target]++;
+			return jp;
+		}
+		*waitingp = 1;
+	}
+	return NULL;
+}
+
+static int
+binding_luid_late(struct binding_luids *lp)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > lp->bl_deadline.tv_sec ||
+		(now.tv_sec == lp->bl_deadline.tv_sec &&
+		 now.tv_nsec >= lp->bl_deadline.tv_nsec);
+}
+
+/*
+ * Get LUIDs until none are left or the deadline passes.
+ * A LUID isn't started after the deadline, but one in flight finishes.
+ */
+static void *
+binding_luid_worker(void *arg)
+{
+	struct binding_luids *lp = arg;
+	struct binding_luid *jp;
+	int waiting;
+
+	pthread_mutex_lock(&lp->bl_lock);
+	while (!binding_luid_late(lp)) {
+		jp = binding_luid_next(lp, &waiting);
+		if (jp == NULL) {
+			if (!waiting)
+				break;
+			pthread_cond_timedwait(&lp->bl_cond, &lp->bl_lock,
+					       &lp->bl_deadline);
+			continue;
+		}
+		pthread_mutex_unlock(&lp->bl_lock);
+		sg_get_dev_id(jp->lj_sg, jp->lj_luid->buffer,
+			      sizeof(jp->lj_luid->buffer));
+		pthread_mutex_lock(&lp->bl_lock);
+		jp->lj_state = LUID_DONE;
+		lp->bl_in_flight[jp->lj_target]--;
+		pthread_cond_broadcast(&lp->bl_cond);
+	}
+	pthread_mutex_unlock(&lp->bl_lock);
+	return NULL;
+}
+
+static inline int
+binding_luid_gotten(const struct binding_luid *jp)
+{
+	return jp->lj_state == LUID_DONE && jp->lj_luid->buffer[0] != 0;
+}
+
+/*
+ * Report LUIDs not gotten for a target, unless done since the last refresh.
+ * The first LUID_REPORT_LUNS of them are named.  first is the index of
+ * the target's first job; its others follow.
+ */
+static void
+binding_luid_report(struct binding_luids *lp, u_int32_t first,
+		    u_int32_t failed, u_int32_t late)
+{
+	struct binding_luid *jp = &lp->bl_jobs[first];
+	struct binding_luid *ep;
+	char luns[LUID_REPORT_LUNS * sizeof(",4294967295") + sizeof(",...")];
+	size_t len = 0;
+	u_int32_t shown = 0;
+	u_int64_t key;
+	u_int32_t i;
+
+	key = binding_luid_key(jp->lj_hba, jp->lj_port, jp->lj_tgt);
+	if ((uintptr_t) sa_hash_lookup(&binding_luid_failed, key) ==
+	    binding_generation)
+		return;
+	sa_hash_insert(&binding_luid_failed, key,
+		       (void *) (uintptr_t) binding_generation);
+	luns[0] = '\0';
+	for (i = first; i < lp->bl_count && shown < failed; i++) {
+		ep = &lp->bl_jobs[i];
+		if (ep->lj_target != jp->lj_target || binding_luid_gotten(ep))
+			continue;
+		if (shown++ == LUID_REPORT_LUNS) {
+			snprintf(luns + len, sizeof(luns) - len, ",...");
+			break;
+		}
+		len += snprintf(luns + len, sizeof(luns) - len, "%s%u",
+				len ? "," : "", ep->lj_lun);
+	}
+	fprintf(stderr, "%s: no LUID for %u LUNs of target %u:%u:%u: %s%s\n",
+		__func__, failed, jp->lj_hba, jp->lj_port, jp->lj_tgt, luns,
+		late ? " (deadline passed)" : "");
+}
+
+/*
+ * Get the queued LUIDs, several at a time, and report those not gotten.
+ * The calling thread works too, so the LUIDs are still gotten if no
+ * thread can be started.
+ */
+static void
+binding_luid_run(struct binding_luids *lp)
+{
+	pthread_t threads[LUID_THREADS - 1];
+	pthread_condattr_t attr;
+	struct binding_luid *jp;
+	u_int32_t started = 0;
+	u_int32_t *failed;
+	u_int32_t *late;
+	u_int32_t t;
+	u_int32_t i;
+
+	if (lp->bl_count == 0)
+		return;
+	lp->bl_in_flight = calloc(lp->bl_target_count,
+				  sizeof(*lp->bl_in_flight));
+	if (lp->bl_in_flight == NULL) {
+		for (i = 0; i < lp->bl_count; i++) {
+			jp = &lp->bl_jobs[i];
+			sg_get_dev_id(jp->lj_sg, jp->lj_luid->buffer,
+				      sizeof(jp->lj_luid->buffer));
+			binding_luid_keep(jp->lj_cache, jp->lj_luid);
+		}
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &lp->bl_deadline);
+	lp->bl_deadline.tv_sec += LUID_DEADLINE;
+	pthread_mutex_init(&lp->bl_lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&lp->bl_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	for (i = 0; i < LUID_THREADS - 1 && i + 1 < lp->bl_count; i++)
+		if (pthread_create(&threads[started], NULL,
+				   binding_luid_worker, lp) == 0)
+			started++;
+	binding_luid_worker(lp);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	/*
+	 * Count the LUIDs not gotten per target, in what's left of the
+	 * in-flight counts, which are back to zero.
+	 */
+	failed = lp->bl_in_flight;
+	late = calloc(lp->bl_target_count, sizeof(*late));
+	for (i = 0; i < lp->bl_count; i++) {
+		jp = &lp->bl_jobs[i];
+		if (binding_luid_gotten(jp)) {
+			binding_luid_keep(jp->lj_cache, jp->lj_luid);
+			continue;
+		}
+		failed[jp->lj_target]++;
+		if (late != NULL && jp->lj_state != LUID_DONE)
+			late[jp->lj_target]++;
+	}
+	for (i = 0; i < lp->bl_count; i++) {
+		jp = &lp->bl_jobs[i];
+		t = jp->lj_target;
+		if (failed[t] == 0)
+			continue;
+		binding_luid_report(lp, i, failed[t], late ? late[t] : 0);
+		failed[t] = 0;
+	}
+	free(late);
+	pthread_cond_destroy(&lp->bl_cond);
+	pthread_mutex_destroy(&lp->bl_lock);
+	free(lp->bl_in_flight);
+}
+
+/*
+ * List a SCSI device for the warm-up thread.
+ */
+static void
+binding_keys_add(struct binding_keys *kp, u_int32_t hba, u_int32_t port,
+		 u_int32_t tgt, u_int32_t lun)
+{
+	u_int64_t *keys;
+	u_int64_t key;
+	u_int32_t size;
+
+	if (binding_lun_key(hba, port, tgt, lun, &key) != 0)
+		return;
+	if (kp->bk_count >= kp->bk_size) {
+		size = kp->bk_size ? kp->bk_size * 2 : 64;
+		keys = realloc(kp->bk_keys, size * sizeof(*keys));
+		if (keys == NULL)
+			return;
+		kp->bk_keys = keys;
+		kp->bk_size = size;
+	}
+	kp->bk_keys[kp->bk_count++] = key;
+}
+
 static int
 get_binding_target_mapping(struct dirent *dp, void *ctxt_arg)
 {
 	struct binding_context *cp = ctxt_arg;
-	struct port_info *pp;
+	struct port_info *lp;
+	struct rport_info *rp;
 	HBA_FCPSCSIENTRY *sp;
 	HBA_FCPSCSIENTRYV2 *s2p;
 	HBA_SCSIID *scp = NULL;
 	HBA_FCPID *fcp = NULL;
 	HBA_LUID *luid = NULL;
-	char name[50];
+	struct binding_lun lun_buf;
+	struct binding_lun *bp;
 	u_int32_t hba = -1;
 	u_int32_t port = -1;
 	u_int32_t tgt = -1;
@@ -218,6 +1022,10 @@ get_binding_target_mapping(struct dirent *dp, void *ctxt_arg)
 	    (lun != cp->oc_lun && cp->oc_lun != -1)) {
 		return 0;
 	}
+	if (cp->oc_keys != NULL) {
+		binding_keys_add(cp->oc_keys, hba, port, tgt, lun);
+		return 0;
+	}
 
 	/*
 	 * Name matches.  Add to count and to mapping list if there's room.
@@ -243,46 +1051,192 @@ get_binding_target_mapping(struct dirent *dp, void *ctxt_arg)
 			fprintf(stderr, "*** Fatal! ***\n");
 			break;
 		}
-		pp = cp->oc_rport;
-		if (pp == NULL)
-			pp = adapter_get_rport_target(cp->oc_handle,
-							port, tgt);
-		if (pp != NULL) {
-			fcp->FcId = pp->ap_attr.PortFcId;
-			fcp->NodeWWN = pp->ap_attr.NodeWWN;
-			fcp->PortWWN = pp->ap_attr.PortWWN;
+		rp = NULL;
+		lp = adapter_get_port_by_host(hba);
+		if (lp != NULL && lp->ap_index == port)
+			rp = adapter_get_rport_by_target(lp, tgt);
+		if (rp != NULL) {
+			fcp->FcId = rp->rp_fcid;
+			rport_load(rp, RPORT_ATTR_WWNN);
+			copy_wwn(&fcp->NodeWWN, rp->rp_cold->rc_wwnn);
+			copy_wwn(&fcp->PortWWN, rp->rp_wwpn);
 			fcp->FcpLun = (HBA_UINT64) lun;
 		}
 
 		/*
-		 * Find OS device name by searching for symlink block:<device>
-		 * and SG name by searching for scsi_generic:<name>
-		 * in device subdirectory.
+		 * Find OS device name and SG name from the SCSI device index.
 		 */
-		snprintf(name, sizeof(name),
-			 SYSFS_LUN_DIR "/%s/device", dp->d_name);
 		cp->oc_sg[0] = '\0';
-		cp->oc_scp = scp;
 		scp->OSDeviceName[0] = '\0';
-		/* save a copy of the dir name */
-		sa_strncpy_safe(cp->oc_path, sizeof(cp->oc_path),
-				name, sizeof(name));
-		sa_dir_read(name, get_binding_os_names, cp);
+		bp = binding_lun_lookup(hba, port, tgt, lun, &lun_buf);
+		if (bp != NULL) {
+			sa_strncpy_safe(cp->oc_sg, sizeof(cp->oc_sg),
+					bp->bl_sg, sizeof(bp->bl_sg));
+			sa_strncpy_safe(scp->OSDeviceName,
+					sizeof(scp->OSDeviceName),
+					bp->bl_block, sizeof(bp->bl_block));
+			if (bp == &lun_buf)
+				bp = NULL;      /* not kept */
+		}
 		scp->ScsiBusNumber = hba;
 		scp->ScsiTargetNumber = tgt;
 		scp->ScsiOSLun = lun;
 
 		/*
-		 * find the LUN ID information by using scsi_generic I/O.
+		 * find the LUN ID information by using scsi_generic I/O,
+		 * unless it's been gotten before.
 		 */
-		if (luid != NULL && cp->oc_sg[0] != '\0')
-			sg_get_dev_id(cp->oc_sg, luid->buffer,
-					  sizeof(luid->buffer));
+		if (luid != NULL && bp != NULL &&
+		    (bp->bl_flags & BINDING_LUN_LUID))
+			memcpy(luid->buffer, bp->bl_luid, sizeof(luid->buffer));
+		else if (luid != NULL && cp->oc_sg[0] != '\0')
+			binding_luid_add(cp->oc_luids, luid, bp, cp->oc_sg,
+					 hba, port, tgt, lun);
 	}
 	cp->oc_count++;
 	return 0;
 }
 
+/*
+ * Read a target directory's SCSI devices, named H:C:T:L like those in
+ * SYSFS_LUN_DIR.
+ */
+static int
+binding_read_target(struct dirent *dp, void *arg)
+{
+	struct binding_context *cp = arg;
+	char dir[sizeof(cp->oc_path) + sizeof(dp->d_name)];
+	u_int32_t hba;
+	u_int32_t port;
+	u_int32_t tgt;
+
+	if (sscanf(dp->d_name, "target%u:%u:%u", &hba, &port, &tgt) != 3 ||
+	    (tgt != cp->oc_target && cp->oc_target != -1))
+		return 0;
+	snprintf(dir, sizeof(dir), "%s/%s", cp->oc_path, dp->d_name);
+	sa_dir_read(dir, get_binding_target_mapping, cp);
+	return 0;
+}
+
+/*
+ * Read the targets of a remote port of the host.
+ */
+static int
+binding_read_rport(struct dirent *dp, void *arg)
+{
+	struct binding_context *cp = arg;
+	u_int32_t hba;
+	u_int32_t port;
+	u_int32_t rport;
+
+	if (sscanf(dp->d_name, SYSFS_RPORT_DIR, &hba, &port, &rport) != 3 ||
+	    (port != cp->oc_port && cp->oc_port != -1))
+		return 0;
+	if (snprintf(cp->oc_path, sizeof(cp->oc_path),
+		     SYSFS_HOST_DIR "/host%u/device/%s",
+		     cp->oc_kern_hba, dp->d_name) >= sizeof(cp->oc_path))
+		return 0;
+	sa_dir_read(cp->oc_path, binding_read_target, cp);
+	return 0;
+}
+
+/*
+ * Read the SCSI devices of the context's host for a target mapping.
+ * They're found under the host's device, in
+ * rport-H:C-R/targetH:C:T/H:C:T:L, so the cost follows the LUNs of
+ * the host and not all the SCSI devices of the system.  If the host's
+ * device can't be read, all of SYSFS_LUN_DIR is.
+ */
+static void
+binding_read_host(struct binding_context *cp)
+{
+	char dir[80];
+
+	snprintf(dir, sizeof(dir), SYSFS_HOST_DIR "/host%u/device",
+		 cp->oc_kern_hba);
+	if (sa_dir_read(dir, binding_read_rport, cp) != 0)
+		sa_dir_read(SYSFS_LUN_DIR, get_binding_target_mapping, cp);
+}
+
+/*
+ * List the SCSI devices of a host for the warm-up thread.
+ * Only /sys is read.  Returns the count, with the keys in a malloced
+ * array at *keysp.
+ */
+u_int32_t
+binding_warm_find(u_int32_t kern_hba, u_int64_t **keysp)
+{
+	struct binding_context ctxt;
+	struct binding_keys keys;
+
+	memset(&ctxt, 0, sizeof(ctxt));
+	memset(&keys, 0, sizeof(keys));
+	ctxt.oc_kern_hba = kern_hba;
+	ctxt.oc_port = -1;
+	ctxt.oc_target = -1;
+	ctxt.oc_lun = -1;
+	ctxt.oc_keys = &keys;
+	binding_read_host(&ctxt);
+	*keysp = keys.bk_keys;
+	return keys.bk_count;
+}
+
+/*
+ * Read a SCSI device ahead for the warm-up thread: its device names,
+ * LUID and standard INQUIRY data.  The result is queued for
+ * binding_warm_take(), as the index belongs to the calling threads.
+ */
+void
+binding_warm_lun(u_int64_t key)
+{
+	struct binding_warm *wp;
+	struct binding_lun *bp;
+	HBA_LUID luid;
+	HBA_UINT8 sense[32];
+	HBA_UINT32 sense_len = sizeof(sense);
+	HBA_UINT32 len;
+	HBA_UINT8 stat;
+	u_int32_t hba;
+	u_int32_t port;
+	u_int32_t tgt;
+	u_int32_t lun;
+
+	wp = malloc(sizeof(*wp));
+	if (wp == NULL)
+		return;
+	memset(wp, 0, sizeof(*wp));
+	wp->bw_key = key;
+	pthread_mutex_lock(&binding_warm_lock);
+	wp->bw_seq = binding_warm_seq;
+	pthread_mutex_unlock(&binding_warm_lock);
+
+	bp = &wp->bw_lun;
+	binding_lun_unkey(key, &hba, &port, &tgt, &lun);
+	if (binding_lun_read(hba, port, tgt, lun, bp) != 0) {
+		free(wp);
+		return;
+	}
+	if (bp->bl_sg[0] != '\0') {
+		memset(&luid, 0, sizeof(luid));
+		sg_get_dev_id(bp->bl_sg, luid.buffer, sizeof(luid.buffer));
+		binding_luid_keep(bp, &luid);
+		len = sizeof(bp->bl_inq);
+		if (sg_issue_inquiry(bp->bl_sg, 0, 0, bp->bl_inq, &len, &stat,
+				     sense, &sense_len) == HBA_STATUS_OK &&
+		    stat == SCSI_ST_GOOD) {
+			bp->bl_inq_len = len;
+			bp->bl_flags |= BINDING_LUN_INQ;
+			if (len < sizeof(bp->bl_inq))
+				bp->bl_flags |= BINDING_LUN_INQ_ALL;
+		}
+	}
+
+	pthread_mutex_lock(&binding_warm_lock);
+	if (sa_table_append(&binding_warm, wp) < 0)
+		free(wp);
+	pthread_mutex_unlock(&binding_warm_lock);
+}
+
 /*
  * Get FCP target mapping.
  */
@@ -295,8 +1249,8 @@ get_binding_target_mapping_v1(HBA_HANDLE handle, HBA_FCPTARGETMAPPING *map)
 	ap = adapter_open_handle(handle);
 	if (ap == NULL)
 		return HBA_STATUS_ERROR_INVALID_HANDLE;
+	binding_uevents();
 	memset(&ctxt, 0, sizeof(ctxt));
-	ctxt.oc_handle = handle;
 	ctxt.oc_kern_hba = ap->ad_kern_index;
 	ctxt.oc_port = -1;
 	ctxt.oc_target = -1;
@@ -306,7 +1260,7 @@ get_binding_target_mapping_v1(HBA_HANDLE handle, HBA_FCPTARGETMAPPING *map)
 	ctxt.oc_entries = map->entry;
 	ctxt.oc_status = HBA_STATUS_OK;
 	memset(map->entry, 0, sizeof(map->entry[0]) * ctxt.oc_limit);
-	sa_dir_read(SYSFS_LUN_DIR, get_binding_target_mapping, &ctxt);
+	binding_read_host(&ctxt);
 	map->NumberOfEntries = ctxt.oc_count;
 	if (ctxt.oc_status == HBA_STATUS_OK && ctxt.oc_count > ctxt.oc_limit)
 		ctxt.oc_status = HBA_STATUS_ERROR_MORE_DATA;
@@ -314,40 +1268,209 @@ get_binding_target_mapping_v1(HBA_HANDLE handle, HBA_FCPTARGETMAPPING *map)
 }
 
 /*
- * Get FCP target mapping.
+ * Get the FCP target mapping V2 entries of a local port.
+ * On entry *countp is the room in entries, and on return the number of
+ * entries there are.  LUIDs are only gotten for entries filled in.
  */
-HBA_STATUS
-get_binding_target_mapping_v2(HBA_HANDLE handle, HBA_WWN wwn,
-			       HBA_FCPTARGETMAPPINGV2 *map)
+static HBA_STATUS
+binding_map_v2(struct port_info *pp, HBA_FCPSCSIENTRYV2 *entries,
+	       HBA_UINT32 *countp)
 {
 	struct binding_context ctxt;
-	struct adapter_info *ap;
-	struct port_info *pp;
+	struct binding_luids luids;
 
-	pp = adapter_get_port_by_wwn(handle, wwn, NULL);
-	if (pp == NULL)
-		return HBA_STATUS_ERROR_INVALID_HANDLE;
-	ap = pp->ap_adapt;
-	if (ap == NULL)
-		return HBA_STATUS_ERROR_INVALID_HANDLE;
+	binding_uevents();
 	memset(&ctxt, 0, sizeof(ctxt));
-	ctxt.oc_handle = handle;
-	ctxt.oc_kern_hba = ap->ad_kern_index;
+	ctxt.oc_kern_hba = pp->ap_adapt->ad_kern_index;
 	ctxt.oc_port = pp->ap_index;
 	ctxt.oc_target = -1;
 	ctxt.oc_lun = -1;
-	ctxt.oc_limit = map->NumberOfEntries;
+	ctxt.oc_limit = *countp;
 	ctxt.oc_ver = 2;
-	ctxt.oc_entries = map->entry;
+	ctxt.oc_entries = entries;
 	ctxt.oc_status = HBA_STATUS_OK;
-	memset(map->entry, 0, sizeof(map->entry[0]) * ctxt.oc_limit);
-	sa_dir_read(SYSFS_LUN_DIR, get_binding_target_mapping, &ctxt);
-	map->NumberOfEntries = ctxt.oc_count;
+	memset(&luids, 0, sizeof(luids));
+	ctxt.oc_luids = &luids;
+	if (ctxt.oc_limit)
+		memset(entries, 0, sizeof(entries[0]) * ctxt.oc_limit);
+	binding_read_host(&ctxt);
+	binding_luid_run(&luids);
+	free(luids.bl_jobs);
+	sa_hash_destroy(&luids.bl_targets);
+	*countp = ctxt.oc_count;
 	if (ctxt.oc_status == HBA_STATUS_OK && ctxt.oc_count > ctxt.oc_limit)
 		ctxt.oc_status = HBA_STATUS_ERROR_MORE_DATA;
 	return ctxt.oc_status;
 }
 
+/*
+ * Get FCP target mapping.
+ */
+HBA_STATUS
+get_binding_target_mapping_v2(HBA_HANDLE handle, HBA_WWN wwn,
+			       HBA_FCPTARGETMAPPINGV2 *map)
+{
+	struct port_info *pp;
+	HBA_UINT32 count;
+	HBA_STATUS status;
+
+	pp = adapter_get_port_by_wwn(handle, wwn, NULL);
+	if (pp == NULL || pp->ap_adapt == NULL)
+		return HBA_STATUS_ERROR_INVALID_HANDLE;
+	count = map->NumberOfEntries;
+	status = binding_map_v2(pp, map->entry, &count);
+	map->NumberOfEntries = count;
+	return status;
+}
+
+/*
+ * Snapshots of FCP target mappings being read in pieces.
+ */
+struct binding_map {
+	HBA_FCPSCSIENTRYV2    *bm_entries;
+	u_int32_t             bm_count;
+	u_int32_t             bm_next;      /* next entry to return */
+};
+
+static struct sa_table binding_maps;    /* binding_map by cursor - 1 */
+
+/*
+ * Extension: count the FCP target mapping entries of a local port.
+ * No SCSI commands are sent.
+ */
+HBA_STATUS
+hbalinux_get_mapping_count(HBA_WWN wwn, HBA_UINT32 *countp)
+{
+	struct port_info *pp;
+	HBA_STATUS status = HBA_STATUS_OK;
+
+	adapter_lock();
+	pp = adapter_find_port(wwn);
+	if (pp == NULL || pp->ap_adapt == NULL) {
+		status = HBA_STATUS_ERROR_ILLEGAL_WWN;
+	} else {
+		*countp = 0;
+		binding_map_v2(pp, NULL, countp);
+	}
+	adapter_unlock();
+	return status;
+}
+
+/*
+ * Take a snapshot of the FCP target mapping of a local port.
+ */
+static HBA_STATUS
+binding_map_open(struct port_info *pp, HBA_UINT32 *cursorp,
+		 HBA_UINT32 *countp)
+{
+	struct binding_map *mp;
+	HBA_FCPSCSIENTRYV2 *entries;
+	HBA_UINT32 size = 0;
+	HBA_UINT32 count;
+	u_int32_t slot;
+	int i;
+
+	mp = malloc(sizeof(*mp));
+	if (mp == NULL)
+		return HBA_STATUS_ERROR;
+	memset(mp, 0, sizeof(*mp));
+
+	/*
+	 * Size the snapshot by a count, then fill it.  LUNs added in
+	 * between mean trying again.
+	 */
+	binding_map_v2(pp, NULL, &size);
+	for (i = 0; i < 3; i++) {
+		entries = realloc(mp->bm_entries,
+				  (size ? size : 1) * sizeof(*entries));
+		if (entries == NULL)
+			break;
+		mp->bm_entries = entries;
+		count = size;
+		if (binding_map_v2(pp, entries, &count) == HBA_STATUS_OK) {
+			mp->bm_count = count;
+			for (slot = 0; slot < binding_maps.st_limit &&
+			     binding_maps.st_table[slot] != NULL; slot++)
+				;
+			if (sa_table_insert(&binding_maps, slot, mp) < 0)
+				break;
+			*cursorp = slot + 1;
+			*countp = count;
+			return HBA_STATUS_OK;
+		}
+		size = count;
+	}
+	free(mp->bm_entries);
+	free(mp);
+	return HBA_STATUS_ERROR;
+}
+
+/*
+ * Extension: take a snapshot of the FCP target mapping of a local port,
+ * to be read in pieces by hbalinux_mapping_read().
+ */
+HBA_STATUS
+hbalinux_mapping_open(HBA_WWN wwn, HBA_UINT32 *cursorp, HBA_UINT32 *countp)
+{
+	struct port_info *pp;
+	HBA_STATUS status;
+
+	adapter_lock();
+	pp = adapter_find_port(wwn);
+	if (pp == NULL || pp->ap_adapt == NULL)
+		status = HBA_STATUS_ERROR_ILLEGAL_WWN;
+	else
+		status = binding_map_open(pp, cursorp, countp);
+	adapter_unlock();
+	return status;
+}
+
+/*
+ * Extension: read the next entries of a mapping snapshot.
+ * *countp is set to the number read, which is zero at the end.
+ */
+HBA_STATUS
+hbalinux_mapping_read(HBA_UINT32 cursor, HBA_FCPSCSIENTRYV2 *entries,
+		      HBA_UINT32 *countp)
+{
+	struct binding_map *mp;
+	u_int32_t count;
+
+	adapter_lock();
+	mp = sa_table_lookup(&binding_maps, cursor - 1);
+	if (mp == NULL) {
+		adapter_unlock();
+		return HBA_STATUS_ERROR_ARG;
+	}
+	count = mp->bm_count - mp->bm_next;
+	if (count > *countp)
+		count = *countp;
+	memcpy(entries, mp->bm_entries + mp->bm_next,
+	       count * sizeof(*entries));
+	mp->bm_next += count;
+	*countp = count;
+	adapter_unlock();
+	return HBA_STATUS_OK;
+}
+
+/*
+ * Extension: free a mapping snapshot.
+ */
+HBA_STATUS
+hbalinux_mapping_close(HBA_UINT32 cursor)
+{
+	struct binding_map *mp;
+
+	adapter_lock();
+	mp = sa_table_remove(&binding_maps, cursor - 1);
+	adapter_unlock();
+	if (mp == NULL)
+		return HBA_STATUS_ERROR_ARG;
+	free(mp->bm_entries);
+	free(mp);
+	return HBA_STATUS_OK;
+}
+
 /*
  * Get LUN scsi-generic device name.
  */
@@ -355,32 +1478,25 @@ int
 get_binding_sg_name(struct port_info *lp, HBA_WWN disc_wwpn,
 		     HBA_UINT64 fc_lun, char *buf, size_t len)
 {
-	struct binding_context ctxt;
-	struct port_info *rp;
-	HBA_FCPSCSIENTRYV2 entry;
+	struct binding_lun lun_buf;
+	struct binding_lun *bp;
 
-	/*
-	 * find discovered (remote) port.
-	 */
-	rp = adapter_get_rport_by_wwn(lp, disc_wwpn);
-	if (rp == NULL)
-		return HBA_STATUS_ERROR_ILLEGAL_WWN;
-
-	memset(&ctxt, 0, sizeof(ctxt));
-	memset(&entry, 0, sizeof(entry));
-	ctxt.oc_rport = rp;
-	ctxt.oc_kern_hba = rp->ap_kern_hba;
-	ctxt.oc_port = rp->ap_index;
-	ctxt.oc_target = rp->ap_scsi_target;
-	if (ctxt.oc_target == -1)
-		return ENOENT;
-	ctxt.oc_lun = (int) fc_lun;
-	ctxt.oc_limit = 1;
-	ctxt.oc_ver = 1;
-	ctxt.oc_entries = &entry;
-	sa_dir_read(SYSFS_LUN_DIR, get_binding_target_mapping, &ctxt);
-	if (ctxt.oc_count != 1)
+	bp = binding_lun_find(lp, disc_wwpn, fc_lun, &lun_buf);
+	if (bp == NULL || bp->bl_sg[0] == '\0')
 		return ENOENT;
-	sa_strncpy_safe(buf, len, ctxt.oc_sg, sizeof(ctxt.oc_sg));
+	sa_strncpy_safe(buf, len, bp->bl_sg, sizeof(bp->bl_sg));
 	return 0;
 }
+
+static void
+binding_map_destroy(void)
+{
+	struct binding_map *mp;
+	u_int32_t i;
+
+	sa_table_foreach(&binding_maps, i, mp) {
+		free(mp->bm_entries);
+		free(mp);
+	}
+	sa_table_destroy(&binding_maps);
+}
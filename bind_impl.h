@@ -27,5 +27,15 @@ HBA_STATUS get_binding_target_mapping_v2(HBA_HANDLE, HBA_WWN,
 					  HBA_FCPTARGETMAPPINGV2 *);
 int get_binding_sg_name(struct port_info *,
 			HBA_WWN, HBA_UINT64, char *, size_t);
+int binding_get_inquiry(struct port_info *, HBA_WWN, HBA_UINT64,
+			void *, HBA_UINT32 *);
+void binding_put_inquiry(struct port_info *, HBA_WWN, HBA_UINT64,
+			 const void *, HBA_UINT32, HBA_UINT32);
+void binding_check_sense(struct port_info *, HBA_WWN, HBA_UINT64,
+			 const void *, HBA_UINT32);
+void binding_refresh(void);
+void binding_destroy(void);
+u_int32_t binding_warm_find(u_int32_t, u_int64_t **);
+void binding_warm_lun(u_int64_t);
 
 #endif /* _BIND_IMPL_H_ */
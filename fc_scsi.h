@@ -89,6 +89,15 @@ enum scsi_status {
 	SCSI_ST_ABORTED =	0x40,	/* task aborted */
 };
 
+/*
+ * Sense keys and additional sense codes.
+ */
+enum scsi_sense_key {
+	SCSI_SK_UNIT_ATTN =	0x06,	/* unit attention */
+};
+
+#define	SCSI_ASC_INQ_CHANGED	0x3f03	/* ASC/ASCQ: inquiry data changed */
+
 /*
  * Control byte.
  */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2008, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef _HBALINUX_H_
+#define _HBALINUX_H_
+
+/*
+ * Extensions to the SNIA HBA-API provided by libhbalinux.
+ *
+ * These are called directly, not through the common HBAAPI library,
+ * after HBA_LoadLibrary() has loaded this library.  Handles of the common
+ * library mean nothing here, so local ports are named by their PortWWN.
+ *
+ * Functions filling an array take its length in *countp and return the
+ * number of entries available there.  If the array was too short, as
+ * many entries as fit are filled and HBA_STATUS_ERROR_MORE_DATA is
+ * returned.  A NULL array with *countp zero just asks for the count.
+ *
+ * They may be called from any thread.  The library serializes them
+ * with each other and with its HBA-API handlers.
+ */
+
+#include <hbaapi.h>
+
+/*
+ * Discovered port fields that are known without reading /sys.
+ */
+struct hbalinux_rport {
+	HBA_WWN         PortWWN;
+	HBA_UINT32      PortFcId;
+	HBA_UINT32      PortState;      /* HBA_PORTSTATE */
+	HBA_UINT32      ScsiTargetId;
+	HBA_UINT32      DiscoveredPortIndex; /* as for HBA_GetDiscoveredPort* */
+};
+
+HBA_STATUS hbalinux_get_discovered_ports(HBA_WWN, struct hbalinux_rport *,
+					 HBA_UINT32 *);
+HBA_STATUS hbalinux_get_discovered_port_attrs(HBA_WWN, HBA_PORTATTRIBUTES *,
+					      HBA_UINT32 *);
+
+/*
+ * Bytes used by the adapters, ports and names kept by the library, and
+ * bytes allocated for them.
+ */
+HBA_STATUS hbalinux_get_topology_memory(HBA_UINT64 *, HBA_UINT64 *);
+
+/*
+ * A remote node and the number of paths to it.
+ */
+struct hbalinux_node {
+	HBA_WWN         NodeWWN;
+	HBA_UINT32      PathCount;      /* local port/rport pairs */
+	HBA_UINT32      FabricCount;    /* distinct fabrics of those */
+};
+
+/*
+ * One path to a remote node: a discovered port of a local port.
+ */
+struct hbalinux_path {
+	HBA_WWN         FabricName;     /* of the local port */
+	HBA_WWN         LocalPortWWN;
+	HBA_WWN         PortWWN;
+	HBA_UINT32      PortFcId;
+	HBA_UINT32      PortState;      /* HBA_PORTSTATE */
+	HBA_UINT32      ScsiTargetId;
+};
+
+/*
+ * FCP target mapping V2 entries of a local port, read in pieces.
+ * hbalinux_mapping_open() takes a snapshot, with LUIDs, and returns a
+ * cursor and the entry count.  Each hbalinux_mapping_read() returns up
+ * to *countp more entries, setting *countp to the number returned, zero
+ * at the end.  hbalinux_mapping_close() frees the snapshot.
+ * hbalinux_get_mapping_count() just counts the entries, sending no SCSI
+ * commands.
+ */
+HBA_STATUS hbalinux_get_mapping_count(HBA_WWN, HBA_UINT32 *);
+HBA_STATUS hbalinux_mapping_open(HBA_WWN, HBA_UINT32 *, HBA_UINT32 *);
+HBA_STATUS hbalinux_mapping_read(HBA_UINT32, HBA_FCPSCSIENTRYV2 *,
+				 HBA_UINT32 *);
+HBA_STATUS hbalinux_mapping_close(HBA_UINT32);
+
+/*
+ * Progress of the cache warm-up run at load when HBALINUX_WARMUP is set.
+ * The counts grow as the warm-up goes.
+ */
+struct hbalinux_warmup {
+	HBA_UINT32      State;          /* HBALINUX_WARMUP_* */
+	HBA_UINT32      RportsRead;     /* discovered ports read ahead */
+	HBA_UINT32      LunsFound;      /* SCSI devices to read ahead */
+	HBA_UINT32      LunsRead;       /* of those, read so far */
+};
+
+#define HBALINUX_WARMUP_OFF             0       /* not started */
+#define HBALINUX_WARMUP_RUNNING         1
+#define HBALINUX_WARMUP_DONE            2
+#define HBALINUX_WARMUP_CANCELLED       3       /* library freed first */
+
+HBA_STATUS hbalinux_get_warmup(struct hbalinux_warmup *);
+
+HBA_STATUS hbalinux_get_nodes(struct hbalinux_node *, HBA_UINT32 *);
+HBA_STATUS hbalinux_get_node_paths(HBA_WWN, struct hbalinux_path *,
+				   HBA_UINT32 *);
+
+#endif /* _HBALINUX_H_ */
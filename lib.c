@@ -21,6 +21,8 @@
 #include "api_lib.h"
 #include "adapt_impl.h"
 #include "bind_impl.h"
+#include "uevent_impl.h"
+#include "warm_impl.h"
 
 /**
  * Return the version of the SNIA HBA-API supported by this library.
@@ -58,38 +60,129 @@ static HBA_STATUS get_vendor_lib_attrs(HBA_LIBRARYATTRIBUTES *ap)
  */
 static HBA_STATUS load_library(void)
 {
+	adapter_lock();
 	adapter_init();
+	adapter_unlock();
+	uevent_start();
+	warm_start();
 	return HBA_STATUS_OK;
 }
 
 static HBA_STATUS free_library(void)
 {
+	warm_stop();
+	uevent_stop();
+	adapter_lock();
 	adapter_shutdown();
 	adapter_destroy_all();
+	adapter_unlock();
 	return HBA_STATUS_OK;
 }
 
+/*
+ * Handlers run under adapter_lock(), like the hbalinux.h extensions.
+ * The common library serializes its own calls, but not against the
+ * extensions, which share the topology and caches.
+ */
+#define LIB_LOCKED(type, fn, params, args)				\
+static type lib_##fn params						\
+{									\
+	type rc;							\
+									\
+	adapter_lock();							\
+	rc = fn args;							\
+	adapter_unlock();						\
+	return rc;							\
+}
+
+#define LIB_LOCKED_VOID(fn, params, args)				\
+static void lib_##fn params						\
+{									\
+	adapter_lock();							\
+	fn args;							\
+	adapter_unlock();						\
+}
+
+LIB_LOCKED(HBA_UINT32, adapter_get_count, (void), ())
+LIB_LOCKED(HBA_STATUS, adapter_get_name, (HBA_UINT32 index, char *buf),
+	   (index, buf))
+LIB_LOCKED(HBA_HANDLE, adapter_open, (char *name), (name))
+LIB_LOCKED_VOID(adapter_close, (HBA_HANDLE handle), (handle))
+LIB_LOCKED(HBA_STATUS, adapter_get_attr,
+	   (HBA_HANDLE handle, HBA_ADAPTERATTRIBUTES *attr), (handle, attr))
+LIB_LOCKED(HBA_STATUS, adapter_get_port_attr,
+	   (HBA_HANDLE handle, HBA_UINT32 port, HBA_PORTATTRIBUTES *attr),
+	   (handle, port, attr))
+LIB_LOCKED(HBA_STATUS, get_port_statistics,
+	   (HBA_HANDLE handle, HBA_UINT32 port, HBA_PORTSTATISTICS *stats),
+	   (handle, port, stats))
+LIB_LOCKED(HBA_STATUS, adapter_get_rport_attr,
+	   (HBA_HANDLE handle, HBA_UINT32 port, HBA_UINT32 rport,
+	    HBA_PORTATTRIBUTES *attr),
+	   (handle, port, rport, attr))
+LIB_LOCKED_VOID(adapter_refresh, (HBA_HANDLE handle), (handle))
+LIB_LOCKED(HBA_STATUS, get_binding_target_mapping_v1,
+	   (HBA_HANDLE handle, HBA_FCPTARGETMAPPING *map), (handle, map))
+LIB_LOCKED(HBA_STATUS, scsi_inquiry_v1,
+	   (HBA_HANDLE handle, HBA_WWN wwn, HBA_UINT64 lun,
+	    HBA_UINT8 evpd, HBA_UINT32 page, void *resp, HBA_UINT32 resp_len,
+	    void *sense, HBA_UINT32 sense_len),
+	   (handle, wwn, lun, evpd, page, resp, resp_len, sense, sense_len))
+LIB_LOCKED(HBA_STATUS, scsi_report_luns_v1,
+	   (HBA_HANDLE handle, HBA_WWN wwn, void *resp, HBA_UINT32 resp_len,
+	    void *sense, HBA_UINT32 sense_len),
+	   (handle, wwn, resp, resp_len, sense, sense_len))
+LIB_LOCKED(HBA_STATUS, scsi_read_capacity_v1,
+	   (HBA_HANDLE handle, HBA_WWN wwn, HBA_UINT64 lun,
+	    void *resp, HBA_UINT32 resp_len, void *sense, HBA_UINT32 sense_len),
+	   (handle, wwn, lun, resp, resp_len, sense, sense_len))
+LIB_LOCKED(HBA_STATUS, get_binding_target_mapping_v2,
+	   (HBA_HANDLE handle, HBA_WWN wwn, HBA_FCPTARGETMAPPINGV2 *map),
+	   (handle, wwn, map))
+LIB_LOCKED(HBA_STATUS, scsi_inquiry_v2,
+	   (HBA_HANDLE handle, HBA_WWN hba_wwn, HBA_WWN wwn, HBA_UINT64 lun,
+	    HBA_UINT8 byte1, HBA_UINT8 byte2, void *resp, HBA_UINT32 *resp_lenp,
+	    HBA_UINT8 *statp, void *sense, HBA_UINT32 *sense_lenp),
+	   (handle, hba_wwn, wwn, lun, byte1, byte2, resp, resp_lenp, statp,
+	    sense, sense_lenp))
+LIB_LOCKED(HBA_STATUS, scsi_report_luns_v2,
+	   (HBA_HANDLE handle, HBA_WWN hba_wwn, HBA_WWN wwn, void *resp,
+	    HBA_UINT32 *resp_lenp, HBA_UINT8 *statp, void *sense,
+	    HBA_UINT32 *sense_lenp),
+	   (handle, hba_wwn, wwn, resp, resp_lenp, statp, sense, sense_lenp))
+LIB_LOCKED(HBA_STATUS, scsi_read_capacity_v2,
+	   (HBA_HANDLE handle, HBA_WWN hba_wwn, HBA_WWN wwn, HBA_UINT64 lun,
+	    void *resp, HBA_UINT32 *resp_lenp, HBA_UINT8 *statp, void *sense,
+	    HBA_UINT32 *sense_lenp),
+	   (handle, hba_wwn, wwn, lun, resp, resp_lenp, statp, sense,
+	    sense_lenp))
+LIB_LOCKED(HBA_STATUS, get_port_fc4_statistics,
+	   (HBA_HANDLE handle, HBA_WWN wwn, HBA_UINT8 fc4_type,
+	    HBA_FC4STATISTICS *stats),
+	   (handle, wwn, fc4_type, stats))
+
 static HBA_ENTRYPOINTSV2 vendor_lib_entrypoints = {
     .GetVersionHandler =                       get_library_version,
     .LoadLibraryHandler =                      load_library,
     .FreeLibraryHandler =                      free_library,
-    .GetNumberOfAdaptersHandler =              adapter_get_count,
-    .GetAdapterNameHandler =                   adapter_get_name,
-    .OpenAdapterHandler =                      adapter_open,
-    .CloseAdapterHandler =                     adapter_close,
-    .GetAdapterAttributesHandler =             adapter_get_attr,
-    .GetAdapterPortAttributesHandler =         adapter_get_port_attr,
-    .GetPortStatisticsHandler =                get_port_statistics,
-    .GetDiscoveredPortAttributesHandler =      adapter_get_rport_attr,
+    .GetNumberOfAdaptersHandler =              lib_adapter_get_count,
+    .GetAdapterNameHandler =                   lib_adapter_get_name,
+    .OpenAdapterHandler =                      lib_adapter_open,
+    .CloseAdapterHandler =                     lib_adapter_close,
+    .GetAdapterAttributesHandler =             lib_adapter_get_attr,
+    .GetAdapterPortAttributesHandler =         lib_adapter_get_port_attr,
+    .GetPortStatisticsHandler =                lib_get_port_statistics,
+    .GetDiscoveredPortAttributesHandler =      lib_adapter_get_rport_attr,
 
     .GetPortAttributesByWWNHandler =           NULL,
 					/* adapter_get_port_attr_by_wwn, */
     /* Next function deprecated but still supported */
     .SendCTPassThruHandler =                   NULL,
-    .RefreshInformationHandler =               NULL,
+    .RefreshInformationHandler =               lib_adapter_refresh,
     .ResetStatisticsHandler =                  NULL,
     /* Next function deprecated but still supported */
-    .GetFcpTargetMappingHandler =              get_binding_target_mapping_v1,
+    .GetFcpTargetMappingHandler =
+					lib_get_binding_target_mapping_v1,
     /* Next function depricated but still supported */
     .GetFcpPersistentBindingHandler =          NULL,
     .GetEventBufferHandler =                   NULL,
@@ -97,14 +190,15 @@ static HBA_ENTRYPOINTSV2 vendor_lib_entrypoints = {
     .GetRNIDMgmtInfoHandler =                  NULL,
     /* Next function deprecated but still supported */
     .SendRNIDHandler =                         NULL,
-    .ScsiInquiryHandler =                      scsi_inquiry_v1,
-    .ReportLUNsHandler =                       scsi_report_luns_v1,
-    .ReadCapacityHandler =                     scsi_read_capacity_v1,
+    .ScsiInquiryHandler =                      lib_scsi_inquiry_v1,
+    .ReportLUNsHandler =                       lib_scsi_report_luns_v1,
+    .ReadCapacityHandler =                     lib_scsi_read_capacity_v1,
 
     /* V2 handlers */
     .OpenAdapterByWWNHandler =                 NULL,
 					/* adapter_open_by_wwn, */
-    .GetFcpTargetMappingV2Handler =            get_binding_target_mapping_v2,
+    .GetFcpTargetMappingV2Handler =
+					lib_get_binding_target_mapping_v2,
     .SendCTPassThruV2Handler =                 NULL,
     .RefreshAdapterConfigurationHandler =      NULL,
     .GetBindingCapabilityHandler =             NULL,
@@ -118,9 +212,9 @@ static HBA_ENTRYPOINTSV2 vendor_lib_entrypoints = {
     .RemovePersistentBindingHandler =          NULL,
     .RemoveAllPersistentBindingsHandler =      NULL,
     .SendRNIDV2Handler =                       NULL,
-    .ScsiInquiryV2Handler =                    scsi_inquiry_v2,
-    .ScsiReportLUNsV2Handler =                 scsi_report_luns_v2,
-    .ScsiReadCapacityV2Handler =               scsi_read_capacity_v2,
+    .ScsiInquiryV2Handler =                    lib_scsi_inquiry_v2,
+    .ScsiReportLUNsV2Handler =                 lib_scsi_report_luns_v2,
+    .ScsiReadCapacityV2Handler =               lib_scsi_read_capacity_v2,
     .GetVendorLibraryAttributesHandler =       NULL,
 					/* get_vendor_lib_attrs, */
     .RemoveCallbackHandler =                   NULL,
@@ -134,7 +228,7 @@ static HBA_ENTRYPOINTSV2 vendor_lib_entrypoints = {
     .SendRPSHandler =                          NULL,
     .SendSRLHandler =                          NULL,
     .SendLIRRHandler =                         NULL,
-    .GetFC4StatisticsHandler =                 get_port_fc4_statistics,
+    .GetFC4StatisticsHandler =                 lib_get_port_fc4_statistics,
     .GetFCPStatisticsHandler =                 NULL,
     .SendRLSHandler =                          NULL,
 };
@@ -129,17 +129,6 @@ static int sys_read_speed(const char *dir, const char *file, char *buf,
  * Code for OpenFC-supported adapters.
  */
 
-static int
-counting_rports(struct dirent *dp, void *arg)
-{
-	int *count = (int *)arg;
-
-	if (!strstr(dp->d_name, "rport-"))
-		return HBA_STATUS_OK;
-	(*count)++;
-	return HBA_STATUS_OK;
-}
-
 static int
 check_ifindex(struct dirent *dp, void *arg)
 {
@@ -199,6 +188,7 @@ sysfs_scan(struct dirent *dp, void *arg)
 	char ifname[20], buf[256];
 	char *driverName;
 	int data[32], rc, i;
+	size_t mark;
 	char *cp;
 	char *saveptr;	/* for strtok_r */
 	unsigned int ifindex;
@@ -210,13 +200,13 @@ sysfs_scan(struct dirent *dp, void *arg)
 	 * Create a new HBA entry (ap) for the local port
 	 * We will create a new HBA entry for each local port.
 	 */
-	ap = malloc(sizeof(*ap));
+	mark = adapter_alloc_mark();
+	ap = adapter_alloc(sizeof(*ap));
 	if (!ap) {
 		fprintf(stderr, "%s: malloc failed, errno=0x%x\n",
 			__func__, errno);
 		return HBA_STATUS_ERROR;
 	}
-	memset(ap, 0, sizeof(*ap));
 	ap->ad_kern_index = atoi(dp->d_name + sizeof("host") - 1);
 	ap->ad_port_count = 1;
 
@@ -226,17 +216,16 @@ sysfs_scan(struct dirent *dp, void *arg)
 	/*
 	 * Create a new local port entry
 	 */
-	pp = malloc(sizeof(*pp));
+	pp = adapter_alloc(sizeof(*pp));
 	if (pp == NULL) {
 		fprintf(stderr,
 			"%s: malloc for local port %d failed,"
 			" errno=0x%x\n", __func__,
 			ap->ad_port_count - 1, errno);
-		free(ap);
+		adapter_alloc_unwind(mark);
 		return 0;
 	}
 
-	memset(pp, 0, sizeof(*pp));
 	pp->ap_adapt = ap;
 	pp->ap_index = ap->ad_port_count - 1;
 	pp->ap_kern_hba = atoi(dp->d_name + sizeof("host") - 1);
@@ -325,47 +314,41 @@ sysfs_scan(struct dirent *dp, void *arg)
 	if (rc != 4)
 		goto skip;
 
-	/*
-	 * Save the host directory and the hba directory
-	 * in local port structure
-	 */
-	sa_strncpy_safe(pp->host_dir, sizeof(pp->host_dir),
-			host_dir, sizeof(host_dir));
-
 	/* Get NodeWWN */
-	rc = sys_read_wwn(pp->host_dir, "node_name", &wwnn);
+	rc = sys_read_wwn(host_dir, "node_name", &wwnn);
 	memcpy(&pap->NodeWWN, &wwnn, sizeof(wwnn));
 
 	/* Get PortWWN */
-	rc = sys_read_wwn(pp->host_dir, "port_name", &pap->PortWWN);
+	rc = sys_read_wwn(host_dir, "port_name", &pap->PortWWN);
+	pp->ap_wwpn = wwn_to_u64(&pap->PortWWN);
 
 	/* Get PortFcId */
-	rc = sa_sys_read_u32(pp->host_dir, "port_id", &pap->PortFcId);
+	rc = sa_sys_read_u32(host_dir, "port_id", &pap->PortFcId);
 
 	/* Get PortType */
-	rc = sa_sys_read_line(pp->host_dir, "port_type", buf, sizeof(buf));
+	rc = sa_sys_read_line(host_dir, "port_type", buf, sizeof(buf));
 	rc = sa_enum_encode(port_types_table, buf, &pap->PortType);
 
 	/* Get PortState */
-	rc = sa_sys_read_line(pp->host_dir, "port_state", buf, sizeof(buf));
+	rc = sa_sys_read_line(host_dir, "port_state", buf, sizeof(buf));
 	rc = sa_enum_encode(port_states_table, buf, &pap->PortState);
 
 	/* Get PortSpeed */
-	rc = sys_read_speed(pp->host_dir, "speed",
+	rc = sys_read_speed(host_dir, "speed",
 				buf, sizeof(buf),
 				&pap->PortSpeed);
 
 	/* Get PortSupportedSpeed */
-	rc = sys_read_speed(pp->host_dir, "supported_speeds",
+	rc = sys_read_speed(host_dir, "supported_speeds",
 				buf, sizeof(buf),
 				&pap->PortSupportedSpeed);
 
 	/* Get PortMaxFrameSize */
-	rc = sa_sys_read_line(pp->host_dir, "maxframe_size", buf, sizeof(buf));
+	rc = sa_sys_read_line(host_dir, "maxframe_size", buf, sizeof(buf));
 	sscanf(buf, "%d", &pap->PortMaxFrameSize);
 
 	/* Get PortSupportedFc4Types */
-	rc = sa_sys_read_line(pp->host_dir, "supported_fc4s", buf, sizeof(buf));
+	rc = sa_sys_read_line(host_dir, "supported_fc4s", buf, sizeof(buf));
 	sscanf(buf, "0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x "
 		    "0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x "
 		    "0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x "
@@ -380,7 +363,7 @@ sysfs_scan(struct dirent *dp, void *arg)
 		pap->PortSupportedFc4Types.bits[i] = data[i];
 
 	/* Get PortActiveFc4Types */
-	rc = sa_sys_read_line(pp->host_dir, "active_fc4s", buf, sizeof(buf));
+	rc = sa_sys_read_line(host_dir, "active_fc4s", buf, sizeof(buf));
 	sscanf(buf, "0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x "
 		    "0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x "
 		    "0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x "
@@ -395,10 +378,11 @@ sysfs_scan(struct dirent *dp, void *arg)
 		pap->PortActiveFc4Types.bits[i] = data[i];
 
 	/* Get FabricName */
-	rc = sys_read_wwn(pp->host_dir, "fabric_name", &pap->FabricName);
+	rc = sys_read_wwn(host_dir, "fabric_name", &pap->FabricName);
+	pp->ap_fabric = wwn_to_u64(&pap->FabricName);
 
 	/* Get PortSupportedClassofService */
-	rc = sa_sys_read_line(pp->host_dir, "supported_classes",
+	rc = sa_sys_read_line(host_dir, "supported_classes",
 				buf, sizeof(buf));
 
 	cp = strstr(buf, "Class");
@@ -409,9 +393,10 @@ sysfs_scan(struct dirent *dp, void *arg)
 	sa_strncpy_safe(pap->OSDeviceName, sizeof(pap->OSDeviceName),
 			dp->d_name, sizeof(dp->d_name));
 
-	/* Get NumberofDiscoveredPorts */
-	snprintf(buf, sizeof(buf), "%s/device", pp->host_dir);
-	sa_dir_read(buf, counting_rports, &pap->NumberofDiscoveredPorts);
+	/*
+	 * NumberofDiscoveredPorts is filled in from the discovered port
+	 * table when the attributes are requested.
+	 */
 
 	/*
 	 * Add the local port structure into local port table within
@@ -426,7 +411,7 @@ sysfs_scan(struct dirent *dp, void *arg)
 
 	/* Create adapter name */
 	snprintf(buf, sizeof(buf), "fcoe:%s", ifname);
-	ap->ad_name = strdup(buf);
+	ap->ad_name = adapter_intern(buf);
 
 	/* Get vendor_id */
 	rc = sa_sys_read_u32(hba_dir, "vendor", &hba_info.vendor_id);
@@ -529,13 +514,14 @@ sysfs_scan(struct dirent *dp, void *arg)
 
 	/* Get NodeSymbolicName */
 	sa_strncpy_safe(atp->NodeSymbolicName, sizeof(atp->NodeSymbolicName),
-			ap->ad_name, sizeof(atp->NodeSymbolicName));
+			adapter_str(ap->ad_name), sizeof(atp->NodeSymbolicName));
 
 	/* Get NodeWWN - The NodeWWN is the same as
 	 *               the NodeWWN of the local port.
 	 */
 	memcpy((char *)&atp->NodeWWN, (char *)&pap->NodeWWN,
 		sizeof(pap->NodeWWN));
+	ap->ad_wwnn = wwn_to_u64(&atp->NodeWWN);
 
 	/* Get DriverName */
 	snprintf(drv_dir, sizeof(drv_dir), "%s" SYSFS_MODULE , hba_dir);
@@ -562,14 +548,14 @@ sysfs_scan(struct dirent *dp, void *arg)
 	if (rc != HBA_STATUS_OK) {
 		fprintf(stderr, "%s: adapter_create failed, status=%d\n",
 			__func__, rc);
-		adapter_destroy(ap);      /* free adapter and ports */
+		adapter_destroy(ap);      /* free port tables */
+		adapter_alloc_unwind(mark);
 	}
 
 	return 0;
 
 skip:
-	free(pp);
-	free(ap);
+	adapter_alloc_unwind(mark);
 	return 0;
 }
 
@@ -586,6 +572,19 @@ copy_wwn(HBA_WWN *dest, fc_wwn_t src)
 	dest->wwn[7] = (u_char) src;
 }
 
+fc_wwn_t
+wwn_to_u64(const HBA_WWN *wwn)
+{
+	return ((fc_wwn_t) wwn->wwn[0] << 56) |
+		((fc_wwn_t) wwn->wwn[1] << 48) |
+		((fc_wwn_t) wwn->wwn[2] << 40) |
+		((fc_wwn_t) wwn->wwn[3] << 32) |
+		((fc_wwn_t) wwn->wwn[4] << 24) |
+		((fc_wwn_t) wwn->wwn[5] << 16) |
+		((fc_wwn_t) wwn->wwn[6] << 8) |
+		(fc_wwn_t) wwn->wwn[7];
+}
+
 /* Test for a non-zero WWN */
 int
 is_wwn_nonzero(HBA_WWN *wwn)
@@ -688,7 +687,8 @@ get_port_statistics(HBA_HANDLE handle, HBA_UINT32 port, HBA_PORTSTATISTICS *sp)
 		return HBA_STATUS_ERROR;
 	}
 
-	snprintf(dir, sizeof(dir), "%s/statistics", pp->host_dir);
+	snprintf(dir, sizeof(dir), SYSFS_HOST_DIR "/host%u/statistics",
+		 pp->ap_kern_hba);
 	rc = sysfs_get_port_stats(dir, sp);
 	if (rc != 0) {
 		fprintf(stderr, "%s: sysfs_get_port_stats() failed,"
@@ -720,7 +720,8 @@ get_port_fc4_statistics(HBA_HANDLE handle, HBA_WWN wwn,
 	else if (pp == NULL)
 		return HBA_STATUS_ERROR_ILLEGAL_WWN;
 
-	snprintf(dir, sizeof(dir), "%s/statistics", pp->host_dir);
+	snprintf(dir, sizeof(dir), SYSFS_HOST_DIR "/host%u/statistics",
+		 pp->ap_kern_hba);
 	rc = sysfs_get_port_fc4stats(dir, sp);
 	if (rc != 0) {
 		fprintf(stderr, "%s: sysfs_get_port_fc4stats() failed,"
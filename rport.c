@@ -19,28 +19,292 @@
 #include "utils.h"
 #include "api_lib.h"
 #include "adapt_impl.h"
+#include "hbalinux.h"
 
 static int sys_read_port_state(const char *, const char *, u_int32_t *);
 static int sys_read_classes(const char *, const char *, u_int32_t *);
+static void rport_attach(struct port_info *, struct rport_info *);
+static void rport_detach(struct port_info *, struct rport_info *);
 
-static struct sa_table rports_table;          /* table of discovered ports */
+#define RPORT_SCAN_MAX_THREADS    16
+#define RPORT_SCAN_MIN_PER_THREAD 256   /* rports worth a thread */
+#define RPORT_WARM_MAX_AGE        2     /* secs a read-ahead is used for */
+
+/*
+ * Discovered ports of one local port, identified by kernel host number
+ * and channel as parsed from the rport-H:C-N directory name.
+ */
+struct rport_host {
+	struct sa_hash      rh_rports;      /* by kernel rport number */
+};
+
+static struct sa_hash rport_hosts;      /* rport_host by rport_host_key() */
+static int rports_scanned;
+static u_int32_t rport_generation;      /* bumped by each scan */
+static struct sa_table rport_free;      /* removed records for reuse */
+
+/*
+ * Remote ports read ahead by the warm-up thread, taken by the first scan.
+ */
+static pthread_mutex_t rport_warm_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rport_scan *rport_warm;
+static int rport_warm_taken;            /* too late for a read-ahead */
+
+/*
+ * Attached remote ports by remote NodeWWN, for the multipath extensions.
+ * This needs the NodeWWN of every port, which is otherwise read lazily,
+ * so it is only kept once first asked for.
+ */
+struct rport_node {
+	fc_wwn_t            rn_wwnn;
+	struct sa_table     rn_paths;       /* rport_info, without holes */
+};
+
+static struct sa_hash rport_nodes;      /* rport_node by NodeWWN */
+static int rport_nodes_active;
+
+static inline u_int64_t
+rport_host_key(u_int32_t hba, u_int32_t channel)
+{
+	return ((u_int64_t) hba << 32) | channel;
+}
+
+/*
+ * Find the bucket for a host and channel, creating it if asked.
+ */
+static struct rport_host *
+rport_host_get(u_int32_t hba, u_int32_t channel, int create)
+{
+	struct rport_host *hp;
+	u_int64_t key = rport_host_key(hba, channel);
+
+	hp = sa_hash_lookup(&rport_hosts, key);
+	if (hp == NULL && create) {
+		hp = adapter_alloc(sizeof(*hp));
+		if (hp != NULL && sa_hash_insert(&rport_hosts, key, hp) < 0)
+			hp = NULL;
+	}
+	return hp;
+}
+
+/*
+ * Remote ports read by one scan of /sys, before they are moved into
+ * the topology arena.
+ */
+struct rport_scan {
+	struct rport_info   *rs_hot;
+	u_int32_t           rs_count;
+	u_int32_t           rs_size;
+	time_t              rs_time;        /* read-ahead start, monotonic */
+};
+
+/*
+ * Make room for another remote port in the scan arrays.
+ */
+static int
+rport_scan_grow(struct rport_scan *sp)
+{
+	struct rport_info *hot;
+	u_int32_t size;
+
+	if (sp->rs_count < sp->rs_size)
+		return 0;
+	size = sp->rs_size ? sp->rs_size * 2 : 64;
+	hot = realloc(sp->rs_hot, size * sizeof(*hot));
+	if (hot == NULL)
+		return -1;
+	sp->rs_hot = hot;
+	sp->rs_size = size;
+	return 0;
+}
+
+/*
+ * Find the local port a remote port is attached to.
+ */
+static struct port_info *
+rport_lport(struct rport_info *rp)
+{
+	struct port_info *pp;
+
+	if (rp->rp_adapt == NULL)
+		return NULL;
+	pp = adapter_get_port_by_host(rp->rp_kern_hba);
+	if (pp != NULL && pp->ap_index != rp->rp_channel)
+		pp = NULL;
+	return pp;
+}
+
+/*
+ * One entry of the remote port directory, parsed by the scanning thread
+ * and read by a worker.  For a known port, the worker leaves what it
+ * read here for the scanning thread to apply.
+ */
+struct rport_entry {
+	struct rport_info   *re_known;      /* existing record or NULL */
+	u_int32_t           re_hba;
+	u_int32_t           re_channel;
+	u_int32_t           re_index;
+	u_int32_t           re_state;
+	u_int32_t           re_fcid;
+	u_int32_t           re_target;
+	int                 re_changed;
+};
+
+/*
+ * Entries found by one read of the remote port directory.
+ */
+struct rport_dir {
+	struct rport_entry  *rd_entries;
+	u_int32_t           rd_count;
+	u_int32_t           rd_size;
+	int                 rd_all_new;     /* don't look for known ports */
+};
+
+/*
+ * A worker reading a contiguous share of the directory entries into a
+ * private batch.
+ */
+struct rport_worker {
+	pthread_t           rw_thread;
+	struct rport_entry  *rw_entries;
+	u_int32_t           rw_count;
+	int                 rw_started;
+	struct rport_scan   rw_scan;
+};
+
+/*
+ * Read a known remote port during a rescan.
+ * The state, FC_ID and target are read each time, since a port that
+ * logged out and back in between scans may be online both times with a
+ * new FC_ID.  The other attributes are only read again on a change.
+ * The record is not modified here, see rport_update().
+ */
+static void
+rport_read_known(struct rport_entry *ep, const char *rport_dir)
+{
+	struct rport_info *rp = ep->re_known;
+
+	ep->re_state = rp->rp_state;
+	ep->re_fcid = rp->rp_fcid;
+	ep->re_target = rp->rp_scsi_target;
+	sys_read_port_state(rport_dir, "port_state", &ep->re_state);
+	sa_sys_read_u32(rport_dir, "port_id", &ep->re_fcid);
+	sa_sys_read_u32(rport_dir, "scsi_target_id", &ep->re_target);
+	ep->re_changed = ep->re_state != rp->rp_state ||
+		ep->re_fcid != rp->rp_fcid ||
+		ep->re_target != rp->rp_scsi_target;
+}
+
+/*
+ * Apply what rport_read_known() found, fixing up the local port's
+ * indexes if the FC_ID or target changed.
+ */
+static void
+rport_update(struct rport_entry *ep)
+{
+	struct rport_info *rp = ep->re_known;
+	struct port_info *pp;
+
+	rp->rp_gen = rport_generation;
+	if (!ep->re_changed)
+		return;
+	rp->rp_state = ep->re_state;
+	/*
+	 * A new login may have new parameters.  The NodeWWN is kept as the
+	 * kernel keeps the rport for the same remote port.
+	 */
+	rp->rp_cold->rc_valid &= RPORT_ATTR_WWNN;
+	if (ep->re_fcid == rp->rp_fcid && ep->re_target == rp->rp_scsi_target)
+		return;
+	pp = rport_lport(rp);
+	if (pp != NULL)
+		rport_detach(pp, rp);
+	rp->rp_fcid = ep->re_fcid;
+	rp->rp_scsi_target = ep->re_target;
+	if (pp != NULL)
+		rport_attach(pp, rp);
+}
+
+/*
+ * Read a new remote port into a scan batch.
+ * Only the attributes used for lookups are read here.
+ */
+static void
+rport_read_new(struct rport_scan *sp, struct rport_entry *ep,
+		const char *rport_dir)
+{
+	struct rport_info *rp;
+	u_int64_t wwn;
+	int rc;
+
+	if (rport_scan_grow(sp) < 0) {
+		fprintf(stderr, "%s: malloc for remote port %s failed,"
+			" errno=0x%x\n", __func__, rport_dir, errno);
+		return;
+	}
+	rp = &sp->rs_hot[sp->rs_count];
+	memset(rp, 0, sizeof(*rp));
+	rp->rp_kern_hba = ep->re_hba;
+	rp->rp_channel = ep->re_channel;
+	rp->rp_disc_index = ep->re_index;
+
+	rc = 0;
+	rc |= sa_sys_read_u64(rport_dir, "port_name", &wwn);
+	rp->rp_wwpn = wwn;
+	rc |= sa_sys_read_u32(rport_dir, "port_id", &rp->rp_fcid);
+	rc |= sa_sys_read_u32(rport_dir, "scsi_target_id", &rp->rp_scsi_target);
+	rc |= sys_read_port_state(rport_dir, "port_state", &rp->rp_state);
+	if (rc != 0)
+		fprintf(stderr,
+			"%s: errors (%x) from /sys reads in %s\n",
+			__func__, rc, rport_dir);
+	else
+		sp->rs_count++;
+}
+
+/*
+ * Read the /sys attributes for a worker's share of the directory.
+ * Workers touch only their own entries and batch, and the shared
+ * topology is not changed until all of them are done.
+ */
+static void *
+rport_scan_worker(void *arg)
+{
+	struct rport_worker *wp = arg;
+	struct rport_entry *ep;
+	char rport_dir[80];
+	u_int32_t i;
+
+	for (i = 0; i < wp->rw_count; i++) {
+		ep = &wp->rw_entries[i];
+		snprintf(rport_dir, sizeof(rport_dir),
+			SYSFS_RPORT_ROOT "/" SYSFS_RPORT_DIR,
+			ep->re_hba, ep->re_channel, ep->re_index);
+		if (ep->re_known != NULL)
+			rport_read_known(ep, rport_dir);
+		else
+			rport_read_new(&wp->rw_scan, ep, rport_dir);
+	}
+	return NULL;
+}
 
 /*
  * Handle a single remote port from the /sys directory entry.
+ * Only the name is parsed here; the attributes are read by the workers.
  * The return value is 0 unless an error is detected which should stop the
  * directory read.
  */
 static int
 sysfs_get_rport(struct dirent *dp, void *arg)
 {
-	struct port_info *rp;
-	HBA_PORTATTRIBUTES *rpa;
+	struct rport_dir *dirp = arg;
+	struct rport_entry *ep;
+	struct rport_host *hp;
 	int rc;
 	u_int32_t hba;
 	u_int32_t port;
 	u_int32_t rp_index;
-	char *rport_dir;
-	char buf[256];
+	u_int32_t size;
 
 	/*
 	 * Parse name into bus number, channel number, and remote port number.
@@ -57,55 +321,395 @@ sysfs_get_rport(struct dirent *dp, void *arg)
 		return 0;
 	}
 
-	/*
-	 * Allocate a remote port.
-	 */
-	rp = malloc(sizeof(*rp));
-	if (rp == NULL) {
-		fprintf(stderr, "%s: malloc for remote port %s failed,"
-			" errno=0x%x\n", __func__, dp->d_name, errno);
-		return ENOMEM;
-	}
-	memset(rp, 0, sizeof(*rp));
-	rp->ap_kern_hba = hba;
-	rp->ap_index = port;
-	rp->ap_disc_index = rp_index;
-	rpa = &rp->ap_attr;
-
-	snprintf(rpa->OSDeviceName, sizeof(rpa->OSDeviceName), "%s/%s",
-		SYSFS_RPORT_ROOT, dp->d_name);
-	rport_dir = rpa->OSDeviceName;
-	rc = 0;
-	rc |= sys_read_wwn(rport_dir, "node_name", &rpa->NodeWWN);
-	rc |= sys_read_wwn(rport_dir, "port_name", &rpa->PortWWN);
-	rc |= sa_sys_read_u32(rport_dir, "port_id", &rpa->PortFcId);
-	rc |= sa_sys_read_u32(rport_dir, "scsi_target_id", &rp->ap_scsi_target);
-	sa_sys_read_line(rport_dir, "maxframe_size", buf, sizeof(buf));
-	sscanf(buf, "%d", &rpa->PortMaxFrameSize);
-	rc |= sys_read_port_state(rport_dir, "port_state", &rpa->PortState);
-	rc |= sys_read_classes(rport_dir, "supported_classes",
-				   &rpa->PortSupportedClassofService);
-	if (rc != 0 || sa_table_append(&rports_table, rp) < 0) {
-		if (rc != 0)
-			fprintf(stderr,
-				"%s: errors (%x) from /sys reads in %s\n",
-				__func__, rc, dp->d_name);
-		else
-			fprintf(stderr,
-				"%s: sa_table_append error on rport %s\n",
-				__func__, dp->d_name);
-		free(rp);
+	if (dirp->rd_count >= dirp->rd_size) {
+		size = dirp->rd_size ? dirp->rd_size * 2 : 64;
+		ep = realloc(dirp->rd_entries, size * sizeof(*ep));
+		if (ep == NULL) {
+			fprintf(stderr, "%s: malloc for remote port %s failed,"
+				" errno=0x%x\n", __func__, dp->d_name, errno);
+			return ENOMEM;
+		}
+		dirp->rd_entries = ep;
+		dirp->rd_size = size;
 	}
+	ep = &dirp->rd_entries[dirp->rd_count++];
+	memset(ep, 0, sizeof(*ep));
+	ep->re_hba = hba;
+	ep->re_channel = port;
+	ep->re_index = rp_index;
+	if (dirp->rd_all_new)
+		return 0;
+	hp = rport_host_get(hba, port, 0);
+	if (hp != NULL)
+		ep->re_known = sa_hash_lookup(&hp->rh_rports, rp_index);
 	return 0;
 }
 
 /*
- * Get remote port information from /sys.
+ * Number of threads to read remote ports with.
+ * HBALINUX_SCAN_THREADS overrides the default of one per online CPU.
+ * Small fabrics are read by the calling thread alone.
+ */
+static u_int32_t
+rport_scan_threads(u_int32_t count)
+{
+	const char *env;
+	long threads;
+
+	env = getenv("HBALINUX_SCAN_THREADS");
+	if (env != NULL)
+		threads = strtol(env, NULL, 0);
+	else
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > RPORT_SCAN_MAX_THREADS)
+		threads = RPORT_SCAN_MAX_THREADS;
+	if (threads > count / RPORT_SCAN_MIN_PER_THREAD)
+		threads = count / RPORT_SCAN_MIN_PER_THREAD;
+	if (threads < 1)
+		threads = 1;
+	return threads;
+}
+
+/*
+ * Remove a remote port from the topology, keeping its record for reuse.
  */
 static void
+rport_remove(struct rport_host *hp, struct rport_info *rp)
+{
+	struct port_info *pp;
+
+	pp = rport_lport(rp);
+	if (pp != NULL)
+		rport_detach(pp, rp);
+	sa_hash_remove(&hp->rh_rports, rp->rp_disc_index);
+	if (sa_table_append(&rport_free, rp) < 0)
+		fprintf(stderr, "%s: rport record lost\n", __func__);
+}
+
+/*
+ * Move scanned remote ports into the topology arena.
+ * Records of removed ports are reused first, as is that of a port with
+ * the same rport number, which replaces it.  New hot records are kept
+ * contiguous so searches stride over them densely; the cold records are
+ * in a separate array.
+ * Returns -1 if some ports couldn't be stored.  Those that could are,
+ * and the others are new again to the next scan.
+ */
+static int
+rport_scan_store(struct rport_scan *sp)
+{
+	struct rport_info *hot = NULL;
+	struct rport_cold *cold = NULL;
+	struct rport_info *rp;
+	struct rport_info *old;
+	struct rport_cold *rcp;
+	struct rport_host *hp;
+	struct port_info *pp;
+	u_int32_t new_count;
+	u_int32_t lost = 0;
+	u_int32_t i;
+	size_t mark;
+
+	if (sp->rs_count <= rport_free.st_count)
+		new_count = 0;
+	else
+		new_count = sp->rs_count - rport_free.st_count;
+	if (new_count) {
+		mark = adapter_alloc_mark();
+		hot = adapter_alloc(new_count * sizeof(*hot));
+		cold = adapter_alloc(new_count * sizeof(*cold));
+		if (hot == NULL || cold == NULL) {
+			fprintf(stderr, "%s: allocation for %u remote ports "
+				"failed\n", __func__, new_count);
+			adapter_alloc_unwind(mark);
+			new_count = 0;
+		}
+	}
+	for (i = 0; i < sp->rs_count; i++) {
+		rp = sa_table_pop(&rport_free);
+		if (rp != NULL) {
+			rcp = rp->rp_cold;
+		} else if (new_count > 0) {
+			rp = hot++;
+			rcp = cold++;
+			new_count--;
+		} else {
+			lost++;
+			continue;
+		}
+		*rp = sp->rs_hot[i];
+		memset(rcp, 0, sizeof(*rcp));
+		rp->rp_cold = rcp;
+		rp->rp_gen = rport_generation;
+		hp = rport_host_get(rp->rp_kern_hba, rp->rp_channel, 1);
+		if (hp != NULL) {
+			old = sa_hash_lookup(&hp->rh_rports, rp->rp_disc_index);
+			if (old != NULL)
+				rport_remove(hp, old);
+		}
+		if (hp == NULL ||
+		    sa_hash_insert(&hp->rh_rports, rp->rp_disc_index, rp) < 0) {
+			fprintf(stderr, "%s: insert error on "
+				"rport %u:%u-%u\n", __func__,
+				rp->rp_kern_hba, rp->rp_channel,
+				rp->rp_disc_index);
+			sa_table_append(&rport_free, rp);
+			lost++;
+			continue;
+		}
+		pp = adapter_get_port_by_host(rp->rp_kern_hba);
+		if (pp != NULL && pp->ap_index == rp->rp_channel)
+			rport_attach(pp, rp);
+	}
+	return lost ? -1 : 0;
+}
+
+/*
+ * Drop remote ports the latest scan didn't see.
+ */
+static void
+rport_scan_sweep(void)
+{
+	struct rport_host *hp;
+	struct rport_info *rp;
+	u_int32_t i;
+	u_int32_t j;
+
+	sa_hash_foreach(&rport_hosts, i, hp)
+		sa_hash_foreach(&hp->rh_rports, j, rp)
+			if (rp->rp_gen != rport_generation)
+				rport_remove(hp, rp);
+}
+
+/*
+ * Get remote port information from /sys.
+ * Known ports are updated in place, new ones added and missing ones
+ * removed, so this also serves to refresh the discovered ports.
+ *
+ * The directory is listed first and the entries split into contiguous
+ * shares, one per worker, which keeps the scan order when the workers'
+ * batches are stored.  The first worker's share is read by the calling
+ * thread, as is that of any worker that can't be started.
+ * Returns -1 if some new ports couldn't be stored.
+ */
+static int
 sysfs_find_rports(void)
 {
-	sa_dir_read(SYSFS_RPORT_ROOT, sysfs_get_rport, NULL);
+	struct rport_worker workers[RPORT_SCAN_MAX_THREADS];
+	struct rport_worker *wp;
+	struct rport_dir dir;
+	u_int32_t threads;
+	u_int32_t start;
+	u_int32_t i;
+	int rc = 0;
+
+	memset(&dir, 0, sizeof(dir));
+	memset(workers, 0, sizeof(workers));
+	rport_generation++;
+	sa_dir_read(SYSFS_RPORT_ROOT, sysfs_get_rport, &dir);
+
+	threads = rport_scan_threads(dir.rd_count);
+	for (i = 0; i < threads; i++) {
+		wp = &workers[i];
+		start = (u_int64_t) dir.rd_count * i / threads;
+		wp->rw_entries = dir.rd_entries + start;
+		wp->rw_count = (u_int64_t) dir.rd_count * (i + 1) / threads -
+			start;
+		if (i > 0 && pthread_create(&wp->rw_thread, NULL,
+					    rport_scan_worker, wp) == 0)
+			wp->rw_started = 1;
+	}
+	for (i = 0; i < threads; i++) {
+		wp = &workers[i];
+		if (wp->rw_started)
+			pthread_join(wp->rw_thread, NULL);
+		else
+			rport_scan_worker(wp);
+	}
+
+	for (i = 0; i < dir.rd_count; i++)
+		if (dir.rd_entries[i].re_known != NULL)
+			rport_update(&dir.rd_entries[i]);
+	for (i = 0; i < threads; i++) {
+		wp = &workers[i];
+		if (rport_scan_store(&wp->rw_scan) < 0)
+			rc = -1;
+		free(wp->rw_scan.rs_hot);
+	}
+	rport_scan_sweep();
+	free(dir.rd_entries);
+	return rc;
+}
+
+static time_t
+rport_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+static void
+rport_warm_free(struct rport_scan *sp)
+{
+	if (sp != NULL) {
+		free(sp->rs_hot);
+		free(sp);
+	}
+}
+
+/*
+ * Take the remote ports read ahead by the warm-up thread, if any.
+ * Once a scan has been done, a read-ahead is of no further use.  One
+ * begun more than RPORT_WARM_MAX_AGE seconds ago is dropped, so a first
+ * call long after load reports the ports as they are at the call.
+ */
+static struct rport_scan *
+rport_warm_take(void)
+{
+	struct rport_scan *sp;
+
+	pthread_mutex_lock(&rport_warm_lock);
+	sp = rport_warm;
+	rport_warm = NULL;
+	rport_warm_taken = 1;
+	pthread_mutex_unlock(&rport_warm_lock);
+	if (sp != NULL && rport_now() - sp->rs_time > RPORT_WARM_MAX_AGE) {
+		rport_warm_free(sp);
+		sp = NULL;
+	}
+	return sp;
+}
+
+/*
+ * Do the first scan of remote ports, using those read ahead if the
+ * warm-up thread has finished reading them.
+ * Until all ports found have been stored, each call scans again.
+ */
+static void
+rport_scan_first(void)
+{
+	struct rport_scan *sp;
+	int rc;
+
+	if (rports_scanned)
+		return;
+	sp = rport_warm_take();
+	if (sp == NULL) {
+		rc = sysfs_find_rports();
+	} else {
+		rport_generation++;
+		rc = rport_scan_store(sp);
+		rport_warm_free(sp);
+	}
+	rports_scanned = (rc == 0);
+}
+
+/*
+ * Read all remote ports ahead of the first scan.
+ * Called by the warm-up thread, which reads /sys only and leaves the
+ * batch for rport_scan_first() to store.
+ * Returns the number of remote ports read.
+ */
+u_int32_t
+rport_prefetch(void)
+{
+	struct rport_worker worker;
+	struct rport_scan *sp;
+	struct rport_dir dir;
+	u_int32_t count;
+	time_t start;
+
+	memset(&dir, 0, sizeof(dir));
+	memset(&worker, 0, sizeof(worker));
+	dir.rd_all_new = 1;
+	start = rport_now();
+	sa_dir_read(SYSFS_RPORT_ROOT, sysfs_get_rport, &dir);
+	worker.rw_entries = dir.rd_entries;
+	worker.rw_count = dir.rd_count;
+	rport_scan_worker(&worker);
+	free(dir.rd_entries);
+
+	count = worker.rw_scan.rs_count;
+	sp = malloc(sizeof(*sp));
+	if (sp == NULL) {
+		free(worker.rw_scan.rs_hot);
+		return 0;
+	}
+	*sp = worker.rw_scan;
+	sp->rs_time = start;
+	pthread_mutex_lock(&rport_warm_lock);
+	if (!rport_warm_taken && rport_warm == NULL) {
+		rport_warm = sp;
+		sp = NULL;
+	}
+	pthread_mutex_unlock(&rport_warm_lock);
+	rport_warm_free(sp);
+	return count;
+}
+
+/*
+ * Re-read remote ports from /sys.
+ */
+void
+rport_refresh(void)
+{
+	rport_warm_free(rport_warm_take());
+	rports_scanned = (sysfs_find_rports() == 0);
+}
+
+/*
+ * Read the remote port attributes in mask that haven't been read yet.
+ * An attribute that can't be read is left zero and tried again next time.
+ */
+void
+rport_load(struct rport_info *rp, u_int32_t mask)
+{
+	struct rport_cold *rcp = rp->rp_cold;
+	char rport_dir[80];
+	char buf[256];
+	u_int64_t wwn;
+
+	mask &= ~rcp->rc_valid;
+	if (mask == 0)
+		return;
+	snprintf(rport_dir, sizeof(rport_dir),
+		 SYSFS_RPORT_ROOT "/" SYSFS_RPORT_DIR,
+		 rp->rp_kern_hba, rp->rp_channel, rp->rp_disc_index);
+	if ((mask & RPORT_ATTR_WWNN) &&
+	    sa_sys_read_u64(rport_dir, "node_name", &wwn) == 0) {
+		rcp->rc_wwnn = wwn;
+		rcp->rc_valid |= RPORT_ATTR_WWNN;
+	}
+	if ((mask & RPORT_ATTR_MAXFRAME) &&
+	    sa_sys_read_line(rport_dir, "maxframe_size",
+			     buf, sizeof(buf)) == 0 &&
+	    sscanf(buf, "%u", &rcp->rc_maxframe) == 1)
+		rcp->rc_valid |= RPORT_ATTR_MAXFRAME;
+	if ((mask & RPORT_ATTR_CLASSES) &&
+	    sys_read_classes(rport_dir, "supported_classes",
+			     &rcp->rc_classes) == 0)
+		rcp->rc_valid |= RPORT_ATTR_CLASSES;
+}
+
+/*
+ * Fill in HBA-API attributes for a remote port.
+ */
+void
+rport_get_attr(struct rport_info *rp, HBA_PORTATTRIBUTES *pattr)
+{
+	rport_load(rp, RPORT_ATTR_ALL);
+	memset(pattr, 0, sizeof(*pattr));
+	copy_wwn(&pattr->NodeWWN, rp->rp_cold->rc_wwnn);
+	copy_wwn(&pattr->PortWWN, rp->rp_wwpn);
+	pattr->PortFcId = rp->rp_fcid;
+	pattr->PortState = rp->rp_state;
+	pattr->PortMaxFrameSize = rp->rp_cold->rc_maxframe;
+	pattr->PortSupportedClassofService = rp->rp_cold->rc_classes;
+	snprintf(pattr->OSDeviceName, sizeof(pattr->OSDeviceName),
+		 SYSFS_RPORT_ROOT "/" SYSFS_RPORT_DIR,
+		 rp->rp_kern_hba, rp->rp_channel, rp->rp_disc_index);
 }
 
 /*
@@ -169,39 +773,392 @@ sys_read_classes(const char *dir, const char *file, u_int32_t *classp)
 	return rc;
 }
 
+/*
+ * Get a remote port's key in one of the local port's lookup indexes.
+ */
+static u_int64_t
+rport_index_key(struct port_info *pp, struct sa_hash *hp,
+		struct rport_info *rp)
+{
+	if (hp == &pp->ap_rport_wwpn)
+		return rp->rp_wwpn;
+	if (hp == &pp->ap_rport_fcid)
+		return rp->rp_fcid;
+	return rp->rp_scsi_target;
+}
+
+/*
+ * Note a remote port hidden in an index by another with the same key.
+ * Such ports are few, so the table is searched linearly.
+ */
+static void
+rport_shadow_add(struct port_info *pp, struct rport_info *rp)
+{
+	struct rport_info *ep;
+	u_int32_t i;
+
+	sa_table_foreach(&pp->ap_rport_shadow, i, ep)
+		if (ep == rp)
+			return;
+	if (sa_table_append(&pp->ap_rport_shadow, rp) < 0)
+		fprintf(stderr, "%s: append failed for rport %x\n",
+			__func__, rp->rp_disc_index);
+}
+
+static void
+rport_shadow_del(struct port_info *pp, struct rport_info *rp)
+{
+	struct rport_info *ep;
+	u_int32_t i;
+
+	sa_table_foreach(&pp->ap_rport_shadow, i, ep) {
+		if (ep == rp) {
+			sa_table_remove(&pp->ap_rport_shadow, i);
+			sa_table_compact(&pp->ap_rport_shadow);
+			break;
+		}
+	}
+}
+
+/*
+ * Add a remote port to one of the local port's lookup indexes.
+ * If another remote port has the same key, the one with the lower
+ * kernel rport number wins, as a search of ap_rport_list would, and
+ * the other is noted so it can take the key back.
+ */
+static void
+rport_index_add(struct port_info *pp, struct sa_hash *hp, u_int64_t key,
+		struct rport_info *rp)
+{
+	struct rport_info *old;
+
+	old = sa_hash_lookup(hp, key);
+	if (old != NULL && old != rp) {
+		if (old->rp_disc_index < rp->rp_disc_index) {
+			rport_shadow_add(pp, rp);
+			return;
+		}
+		rport_shadow_add(pp, old);
+	}
+	if (sa_hash_insert(hp, key, rp) < 0)
+		fprintf(stderr, "%s: index insert failed for rport %x\n",
+			__func__, rp->rp_disc_index);
+}
+
+/*
+ * Remove a remote port from a lookup index if it is the indexed entry.
+ * The key goes to the remote port with the lowest rport number of
+ * those it hid, if any.
+ */
+static void
+rport_index_del(struct port_info *pp, struct sa_hash *hp, u_int64_t key,
+		struct rport_info *rp)
+{
+	struct rport_info *best = NULL;
+	struct rport_info *ep;
+	u_int32_t i;
+
+	if (sa_hash_lookup(hp, key) != rp)
+		return;
+	sa_hash_remove(hp, key);
+	sa_table_foreach(&pp->ap_rport_shadow, i, ep)
+		if (ep != rp && rport_index_key(pp, hp, ep) == key &&
+		    (best == NULL || ep->rp_disc_index < best->rp_disc_index))
+			best = ep;
+	if (best != NULL && sa_hash_insert(hp, key, best) < 0)
+		fprintf(stderr, "%s: index insert failed for rport %x\n",
+			__func__, best->rp_disc_index);
+}
+
+/*
+ * Add an attached remote port to its node's paths.
+ */
+static void
+rport_node_add(struct rport_info *rp)
+{
+	struct rport_node *np;
+	fc_wwn_t wwnn;
+
+	if (!rport_nodes_active)
+		return;
+	rport_load(rp, RPORT_ATTR_WWNN);
+	if (!(rp->rp_cold->rc_valid & RPORT_ATTR_WWNN))
+		return;
+	wwnn = rp->rp_cold->rc_wwnn;
+	np = sa_hash_lookup(&rport_nodes, wwnn);
+	if (np == NULL) {
+		np = adapter_alloc(sizeof(*np));
+		if (np == NULL)
+			return;
+		memset(np, 0, sizeof(*np));
+		np->rn_wwnn = wwnn;
+		if (sa_hash_insert(&rport_nodes, wwnn, np) < 0)
+			return;
+	}
+	if (sa_table_append(&np->rn_paths, rp) < 0)
+		fprintf(stderr, "%s: append failed for rport %x\n",
+			__func__, rp->rp_disc_index);
+}
+
+/*
+ * Remove a remote port being detached from its node's paths.
+ * Nodes without paths are kept, in case the paths come back.
+ */
+static void
+rport_node_del(struct rport_info *rp)
+{
+	struct rport_node *np;
+	struct rport_info *ep;
+	u_int32_t i;
+
+	if (!rport_nodes_active ||
+	    !(rp->rp_cold->rc_valid & RPORT_ATTR_WWNN))
+		return;
+	np = sa_hash_lookup(&rport_nodes, rp->rp_cold->rc_wwnn);
+	if (np == NULL)
+		return;
+	sa_table_foreach(&np->rn_paths, i, ep) {
+		if (ep == rp) {
+			sa_table_remove(&np->rn_paths, i);
+			sa_table_compact(&np->rn_paths);
+			break;
+		}
+	}
+}
+
+/*
+ * Attach a remote port to its local port's table and indexes.
+ * A port already attached with the same rport number is detached.
+ */
+static void
+rport_attach(struct port_info *pp, struct rport_info *rp)
+{
+	struct rport_info *old;
+
+	old = sa_hash_lookup(&pp->ap_rports, rp->rp_disc_index);
+	if (old) {
+		fprintf(stderr,
+			"%s: discovered port exists. "
+			"hba %x port %x rport %x\n",
+			__func__, pp->ap_kern_hba,
+			pp->ap_index, rp->rp_disc_index);
+		rport_detach(pp, old);
+	}
+	rp->rp_adapt = pp->ap_adapt;
+	if (sa_hash_insert(&pp->ap_rports, rp->rp_disc_index, rp) < 0)
+		fprintf(stderr, "%s: insert failed for rport %x\n",
+			__func__, rp->rp_disc_index);
+	pp->ap_rport_list_stale = 1;
+	rport_index_add(pp, &pp->ap_rport_wwpn, rp->rp_wwpn, rp);
+	rport_index_add(pp, &pp->ap_rport_fcid, rp->rp_fcid, rp);
+	if (rp->rp_scsi_target != -1)
+		rport_index_add(pp, &pp->ap_rport_target,
+				rp->rp_scsi_target, rp);
+	rport_node_add(rp);
+}
+
+/*
+ * Detach a remote port from its local port's table and indexes.
+ */
+static void
+rport_detach(struct port_info *pp, struct rport_info *rp)
+{
+	if (sa_hash_lookup(&pp->ap_rports, rp->rp_disc_index) == rp) {
+		sa_hash_remove(&pp->ap_rports, rp->rp_disc_index);
+		pp->ap_rport_list_stale = 1;
+	}
+	rport_index_del(pp, &pp->ap_rport_wwpn, rp->rp_wwpn, rp);
+	rport_index_del(pp, &pp->ap_rport_fcid, rp->rp_fcid, rp);
+	rport_index_del(pp, &pp->ap_rport_target, rp->rp_scsi_target, rp);
+	rport_shadow_del(pp, rp);
+	rport_node_del(rp);
+	rp->rp_adapt = NULL;
+}
+
 /*
  * Get all discovered ports for a particular port using /sys.
+ * Remote ports are attached to their local port, found by kernel host
+ * number, as they are stored, so there's nothing to do after the scan.
  */
 void
 get_rport_info(struct port_info *pp)
 {
-	struct port_info *rp;
-	int rp_count = 0;
-	int ri;
+	rport_scan_first();
+}
 
-	if (rports_table.st_size == 0)
-		sysfs_find_rports();
+/*
+ * Get the number of discovered ports for a local port.
+ */
+u_int32_t
+get_rport_count(struct port_info *pp)
+{
+	struct rport_host *hp;
 
-	for (ri = 0; ri < rports_table.st_size; ri++) {
-		rp = sa_table_lookup(&rports_table, ri);
-		if (rp != NULL) {
-			if (rp->ap_kern_hba == pp->ap_kern_hba &&
-			    rp->ap_index == pp->ap_index &&
-			    rp->ap_adapt == NULL) {
-				rp->ap_adapt = pp->ap_adapt;
-				if (sa_table_lookup(&pp->ap_rports,
-						    rp->ap_disc_index)) {
-					fprintf(stderr,
-						"%s: discovered port exists. "
-					       "hba %x port %x rport %x\n",
-					       __func__, pp->ap_kern_hba,
-					       pp->ap_index, rp->ap_disc_index);
-				}
-				sa_table_insert(&pp->ap_rports,
-						rp->ap_disc_index, rp);
-			}
-			rp_count++;
+	rport_scan_first();
+	hp = rport_host_get(pp->ap_kern_hba, pp->ap_index, 0);
+	return hp ? hp->rh_rports.sh_count : 0;
+}
+
+/*
+ * Forget all discovered ports.
+ * The remote ports themselves are freed with the rest of the topology
+ * arena by adapter_destroy_all().
+ */
+void
+rport_destroy_all(void)
+{
+	struct rport_host *hp;
+	struct rport_node *np;
+	u_int32_t i;
+
+	sa_hash_foreach(&rport_hosts, i, hp)
+		sa_hash_destroy(&hp->rh_rports);
+	sa_hash_destroy(&rport_hosts);
+	sa_table_destroy(&rport_free);
+	sa_hash_foreach(&rport_nodes, i, np)
+		sa_table_destroy(&np->rn_paths);
+	sa_hash_destroy(&rport_nodes);
+	rport_nodes_active = 0;
+	rports_scanned = 0;
+	rport_warm_free(rport_warm);
+	rport_warm = NULL;
+	rport_warm_taken = 0;
+}
+
+/*
+ * Start keeping the remote node index, adding the ports attached so far.
+ * Later scans keep it up to date as ports are attached and detached.
+ */
+static void
+rport_nodes_start(void)
+{
+	struct rport_host *hp;
+	struct rport_info *rp;
+	u_int32_t i;
+	u_int32_t j;
+
+	rport_scan_first();
+	if (rport_nodes_active)
+		return;
+	rport_nodes_active = 1;
+	sa_hash_foreach(&rport_hosts, i, hp)
+		sa_hash_foreach(&hp->rh_rports, j, rp)
+			if (rp->rp_adapt != NULL)
+				rport_node_add(rp);
+}
+
+/*
+ * Count the distinct fabrics of a node's paths.
+ * Paths are few, so this just compares each with those before it.
+ */
+static u_int32_t
+rport_node_fabrics(struct rport_node *np)
+{
+	struct rport_info **paths;
+	struct port_info *pp;
+	struct port_info *prev;
+	u_int32_t count = 0;
+	u_int32_t i;
+	u_int32_t j;
+
+	paths = (struct rport_info **) np->rn_paths.st_table;
+	for (i = 0; i < np->rn_paths.st_count; i++) {
+		pp = rport_lport(paths[i]);
+		for (j = 0; j < i; j++) {
+			prev = rport_lport(paths[j]);
+			if (prev == pp || (pp != NULL && prev != NULL &&
+			    prev->ap_fabric == pp->ap_fabric))
+				break;
 		}
+		if (j == i)
+			count++;
 	}
+	return count;
 }
 
+static int
+rport_path_cmp(const void **ap, const void **bp)
+{
+	struct port_info *a = rport_lport((struct rport_info *) *ap);
+	struct port_info *b = rport_lport((struct rport_info *) *bp);
+
+	if (a == NULL || b == NULL)
+		return (a != NULL) - (b != NULL);
+	if (a->ap_fabric != b->ap_fabric)
+		return a->ap_fabric < b->ap_fabric ? -1 : 1;
+	if (a->ap_wwpn != b->ap_wwpn)
+		return a->ap_wwpn < b->ap_wwpn ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Extension: list remote nodes with their path and fabric counts.
+ * Nodes are in no particular order.
+ */
+HBA_STATUS
+hbalinux_get_nodes(struct hbalinux_node *nodes, HBA_UINT32 *countp)
+{
+	struct rport_node *np;
+	struct hbalinux_node *hp;
+	HBA_STATUS status;
+	u_int32_t count = 0;
+	u_int32_t i;
+
+	adapter_lock();
+	rport_nodes_start();
+	sa_hash_foreach(&rport_nodes, i, np) {
+		if (np->rn_paths.st_count == 0)
+			continue;
+		if (count < *countp) {
+			hp = &nodes[count];
+			copy_wwn(&hp->NodeWWN, np->rn_wwnn);
+			hp->PathCount = np->rn_paths.st_count;
+			hp->FabricCount = rport_node_fabrics(np);
+		}
+		count++;
+	}
+	status = adapter_fill_status(countp, count);
+	adapter_unlock();
+	return status;
+}
+
+/*
+ * Extension: list the paths to a remote node, grouped by fabric.
+ */
+HBA_STATUS
+hbalinux_get_node_paths(HBA_WWN wwn, struct hbalinux_path *paths,
+			HBA_UINT32 *countp)
+{
+	struct rport_node *np;
+	struct hbalinux_path *hp;
+	struct rport_info *rp;
+	struct port_info *pp;
+	HBA_STATUS status;
+	u_int32_t i;
+
+	adapter_lock();
+	rport_nodes_start();
+	np = sa_hash_lookup(&rport_nodes, wwn_to_u64(&wwn));
+	if (np == NULL || np->rn_paths.st_count == 0) {
+		adapter_unlock();
+		return HBA_STATUS_ERROR_ILLEGAL_WWN;
+	}
+	sa_table_sort(&np->rn_paths, rport_path_cmp);
+	for (i = 0; i < np->rn_paths.st_count && i < *countp; i++) {
+		rp = np->rn_paths.st_table[i];
+		pp = rport_lport(rp);
+		hp = &paths[i];
+		memset(hp, 0, sizeof(*hp));
+		if (pp != NULL) {
+			hp->FabricName = pp->ap_attr.FabricName;
+			hp->LocalPortWWN = pp->ap_attr.PortWWN;
+		}
+		copy_wwn(&hp->PortWWN, rp->rp_wwpn);
+		hp->PortFcId = rp->rp_fcid;
+		hp->PortState = rp->rp_state;
+		hp->ScsiTargetId = rp->rp_scsi_target;
+	}
+	status = adapter_fill_status(countp, np->rn_paths.st_count);
+	adapter_unlock();
+	return status;
+}
@@ -22,6 +22,53 @@
 #include "bind_impl.h"
 #include "fc_scsi.h"
 
+/*
+ * Let the LUN's kept INQUIRY data be dropped if its sense data says
+ * that changed.
+ */
+static void
+scsi_check_sense(struct port_info *pp, HBA_WWN disc_wwpn, HBA_UINT64 fc_lun,
+		 HBA_STATUS status, HBA_UINT8 stat,
+		 const void *sense, HBA_UINT32 sense_len)
+{
+	if (status == HBA_STATUS_OK && stat == SCSI_ST_CHECK)
+		binding_check_sense(pp, disc_wwpn, fc_lun, sense, sense_len);
+}
+
+/*
+ * Issue an INQUIRY.
+ * Standard INQUIRY data is kept for the LUN and answered from there
+ * when it has been read since the last refresh and uevents would have
+ * told of the device going away; see binding_get_inquiry().
+ */
+static HBA_STATUS
+scsi_inquiry(struct port_info *pp, HBA_WWN disc_wwpn, HBA_UINT64 fc_lun,
+	     const char *sg_name, HBA_UINT8 cdb_byte1, HBA_UINT8 cdb_byte2,
+	     void *resp, HBA_UINT32 *resp_lenp, HBA_UINT8 *statp,
+	     void *sense, HBA_UINT32 *sense_lenp)
+{
+	HBA_UINT32 asked = *resp_lenp;
+	HBA_STATUS status;
+	int standard = (cdb_byte1 == 0 && cdb_byte2 == 0);
+
+	if (asked > 255)
+		asked = 255;    /* as sg_issue_inquiry() limits it */
+	if (standard && binding_get_inquiry(pp, disc_wwpn, fc_lun,
+					    resp, resp_lenp) == 0) {
+		*statp = SCSI_ST_GOOD;
+		*sense_lenp = 0;
+		return HBA_STATUS_OK;
+	}
+	status = sg_issue_inquiry(sg_name, cdb_byte1, cdb_byte2,
+				  resp, resp_lenp, statp, sense, sense_lenp);
+	if (standard && status == HBA_STATUS_OK && *statp == SCSI_ST_GOOD)
+		binding_put_inquiry(pp, disc_wwpn, fc_lun, resp,
+				    asked, *resp_lenp);
+	scsi_check_sense(pp, disc_wwpn, fc_lun, status, *statp,
+			 sense, *sense_lenp);
+	return status;
+}
+
 /*
  * Inquiry V1.
  */
@@ -46,8 +93,9 @@ scsi_inquiry_v1(HBA_HANDLE handle, HBA_WWN disc_wwpn, HBA_UINT64 fc_lun,
 	    pp, disc_wwpn, fc_lun, sg_name, sizeof(sg_name)) != 0)
 		return HBA_STATUS_ERROR_TARGET_LUN;
 
-	status = sg_issue_inquiry(sg_name, evpd ? SCSI_INQF_EVPD : 0, page_code,
-				resp, &resp_len, &stat, sense, &sense_len);
+	status = scsi_inquiry(pp, disc_wwpn, fc_lun, sg_name,
+			      evpd ? SCSI_INQF_EVPD : 0, page_code,
+			      resp, &resp_len, &stat, sense, &sense_len);
 	if (status == HBA_STATUS_OK && stat == SCSI_ST_CHECK)
 		status = HBA_STATUS_SCSI_CHECK_CONDITION;
 
@@ -77,8 +125,9 @@ scsi_inquiry_v2(HBA_HANDLE handle, HBA_WWN wwpn, HBA_WWN disc_wwpn,
 	    pp, disc_wwpn, fc_lun, sg_name, sizeof(sg_name)) != 0)
 		return HBA_STATUS_ERROR_TARGET_LUN;
 
-	return sg_issue_inquiry(sg_name, cdb_byte1, cdb_byte2,
-			       resp, resp_lenp, statp, sense, sense_lenp);
+	return scsi_inquiry(pp, disc_wwpn, fc_lun, sg_name, cdb_byte1,
+			    cdb_byte2, resp, resp_lenp, statp,
+			    sense, sense_lenp);
 }
 
 /*
@@ -108,6 +157,8 @@ scsi_read_capacity_v1(HBA_HANDLE handle, HBA_WWN disc_wwpn,
 
 	status = sg_issue_read_capacity(sg_name, resp, &resp_len,
 				 &stat, sense, &sense_len);
+	scsi_check_sense(pp, disc_wwpn, fc_lun, status, stat,
+			 sense, sense_len);
 	if (status == HBA_STATUS_OK && stat == SCSI_ST_CHECK)
 		status = HBA_STATUS_SCSI_CHECK_CONDITION;
 
@@ -126,6 +177,7 @@ scsi_read_capacity_v2(HBA_HANDLE handle, HBA_WWN wwpn,
 {
 	struct port_info *pp;
 	char sg_name[50];
+	HBA_STATUS status;
 
 	/*
 	 * Find port.
@@ -138,8 +190,11 @@ scsi_read_capacity_v2(HBA_HANDLE handle, HBA_WWN wwpn,
 	    pp, disc_wwpn, fc_lun, sg_name, sizeof(sg_name)) != 0)
 		return HBA_STATUS_ERROR_TARGET_LUN;
 
-	return sg_issue_read_capacity(sg_name, resp, resp_lenp,
+	status = sg_issue_read_capacity(sg_name, resp, resp_lenp,
 				statp, sense, sense_lenp);
+	scsi_check_sense(pp, disc_wwpn, fc_lun, status, *statp,
+			 sense, *sense_lenp);
+	return status;
 }
 
 /*
@@ -168,6 +223,7 @@ scsi_report_luns_v1(HBA_HANDLE handle, HBA_WWN disc_wwpn,
 
 	status = sg_issue_report_luns(sg_name, resp, &resp_len,
 				    &stat, sense, &sense_len);
+	scsi_check_sense(pp, disc_wwpn, 0, status, stat, sense, sense_len);
 	if (status == HBA_STATUS_OK && stat == SCSI_ST_CHECK)
 		status = HBA_STATUS_SCSI_CHECK_CONDITION;
 
@@ -185,6 +241,7 @@ scsi_report_luns_v2(HBA_HANDLE handle, HBA_WWN wwpn,
 {
 	struct port_info *pp;
 	char sg_name[50];
+	HBA_STATUS status;
 
 	/*
 	 * Find port.
@@ -197,7 +254,10 @@ scsi_report_luns_v2(HBA_HANDLE handle, HBA_WWN wwpn,
 	    pp, disc_wwpn, 0, sg_name, sizeof(sg_name)) != 0)
 		return HBA_STATUS_ERROR_TARGET_PORT_WWN;
 
-	return sg_issue_report_luns(sg_name, resp, resp_lenp,
+	status = sg_issue_report_luns(sg_name, resp, resp_lenp,
 				  statp, sense, sense_lenp);
+	scsi_check_sense(pp, disc_wwpn, 0, status, *statp,
+			 sense, *sense_lenp);
+	return status;
 }
 
@@ -22,6 +22,365 @@
 #include "adapt_impl.h"
 #include "fc_scsi.h"
 
+#define SG_POOL_MAX     64      /* open sg devices kept */
+#define SG_POOL_IDLE    10      /* seconds an unused device is kept open */
+
+/*
+ * An open sg device, kept for the next command to it.
+ * Opening an sg device allocates its reserve buffer, so descriptors are
+ * kept in a pool, least recently used last, and reused.  Commands on one
+ * descriptor are issued one at a time, under se_lock.
+ * A thread closes descriptors left unused for SG_POOL_IDLE seconds, so
+ * devices aren't held open while the application isn't using them.
+ */
+struct sg_pool_entry {
+	struct sg_pool_entry    *se_next;
+	struct sg_pool_entry    *se_prev;
+	pthread_mutex_t         se_lock;        /* held while issuing */
+	u_int32_t               se_users;       /* holding or waiting */
+	int                     se_dead;        /* out of the pool */
+	int                     se_fd;
+	time_t                  se_used;        /* last use, monotonic secs */
+	char                    se_path[32];
+};
+
+static pthread_mutex_t sg_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sg_pool_entry *sg_pool_head;      /* most recently used */
+static struct sg_pool_entry *sg_pool_tail;
+static u_int32_t sg_pool_count;
+static pthread_cond_t sg_pool_cond;             /* wakes the reaper */
+static pthread_t sg_pool_reaper;
+static int sg_pool_reaping;                     /* reaper started */
+static int sg_pool_stop;
+
+static time_t
+sg_pool_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+/*
+ * List operations, called with sg_pool_lock held.
+ */
+static void
+sg_pool_link(struct sg_pool_entry *ep)
+{
+	ep->se_prev = NULL;
+	ep->se_next = sg_pool_head;
+	if (sg_pool_head != NULL)
+		sg_pool_head->se_prev = ep;
+	else
+		sg_pool_tail = ep;
+	sg_pool_head = ep;
+}
+
+static void
+sg_pool_list_del(struct sg_pool_entry *ep)
+{
+	if (ep->se_prev != NULL)
+		ep->se_prev->se_next = ep->se_next;
+	else
+		sg_pool_head = ep->se_next;
+	if (ep->se_next != NULL)
+		ep->se_next->se_prev = ep->se_prev;
+	else
+		sg_pool_tail = ep->se_prev;
+}
+
+static struct sg_pool_entry *
+sg_pool_find(const char *file)
+{
+	struct sg_pool_entry *ep;
+
+	for (ep = sg_pool_head; ep != NULL; ep = ep->se_next)
+		if (strcmp(ep->se_path, file) == 0)
+			return ep;
+	return NULL;
+}
+
+/*
+ * Take an entry out of the pool.  It's freed by its last user.
+ */
+static void
+sg_pool_unlink(struct sg_pool_entry *ep)
+{
+	if (ep->se_dead)
+		return;
+	sg_pool_list_del(ep);
+	ep->se_dead = 1;
+	sg_pool_count--;
+}
+
+static void
+sg_pool_free(struct sg_pool_entry *ep)
+{
+	close(ep->se_fd);
+	pthread_mutex_destroy(&ep->se_lock);
+	free(ep);
+}
+
+/*
+ * Take an entry out of the pool, freeing it unless it's in use.
+ */
+static void
+sg_pool_drop(struct sg_pool_entry *ep)
+{
+	sg_pool_unlink(ep);
+	if (ep->se_users == 0)
+		sg_pool_free(ep);
+}
+
+/*
+ * Close descriptors not used for SG_POOL_IDLE seconds.  Each is closed
+ * between one and two idle periods after its last use.
+ */
+static void *
+sg_pool_reap(void *arg)
+{
+	struct sg_pool_entry *ep;
+	struct sg_pool_entry *prev;
+	struct timespec wake;
+	time_t now;
+
+	pthread_mutex_lock(&sg_pool_lock);
+	while (!sg_pool_stop) {
+		now = sg_pool_now();
+		for (ep = sg_pool_tail; ep != NULL; ep = prev) {
+			prev = ep->se_prev;
+			if (ep->se_users == 0 && now - ep->se_used >= SG_POOL_IDLE)
+				sg_pool_drop(ep);
+		}
+		if (sg_pool_head == NULL) {
+			pthread_cond_wait(&sg_pool_cond, &sg_pool_lock);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &wake);
+		wake.tv_sec += SG_POOL_IDLE;
+		pthread_cond_timedwait(&sg_pool_cond, &sg_pool_lock, &wake);
+	}
+	pthread_mutex_unlock(&sg_pool_lock);
+	return NULL;
+}
+
+/*
+ * Start the reaper, or wake it for a pool that was empty.
+ * If it can't be started, descriptors are only closed when evicted.
+ */
+static void
+sg_pool_reaper_start(void)
+{
+	pthread_condattr_t attr;
+
+	if (sg_pool_reaping) {
+		if (sg_pool_head == NULL)
+			pthread_cond_signal(&sg_pool_cond);
+		return;
+	}
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sg_pool_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&sg_pool_reaper, NULL, sg_pool_reap, NULL) != 0) {
+		pthread_cond_destroy(&sg_pool_cond);
+		return;
+	}
+	sg_pool_reaping = 1;
+}
+
+/*
+ * Add an entry to the pool, closing the least recently used ones not in
+ * use if there are too many.
+ */
+static void
+sg_pool_add(struct sg_pool_entry *ep)
+{
+	struct sg_pool_entry *old;
+	struct sg_pool_entry *prev;
+
+	sg_pool_reaper_start();
+	ep->se_used = sg_pool_now();
+	sg_pool_link(ep);
+	sg_pool_count++;
+	for (old = sg_pool_tail; old != ep && sg_pool_count > SG_POOL_MAX;
+	     old = prev) {
+		prev = old->se_prev;
+		if (old->se_users == 0)
+			sg_pool_drop(old);
+	}
+}
+
+/*
+ * Open an sg device for the pool.
+ */
+static struct sg_pool_entry *
+sg_pool_open(const char *file)
+{
+	struct sg_pool_entry *ep;
+	int fd;
+
+	fd = open(file, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	ep = malloc(sizeof(*ep));
+	if (ep == NULL) {
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(ep, 0, sizeof(*ep));
+	ep->se_fd = fd;
+	pthread_mutex_init(&ep->se_lock, NULL);
+	sa_strncpy_safe(ep->se_path, sizeof(ep->se_path),
+			file, strlen(file) + 1);
+	return ep;
+}
+
+/*
+ * Get an open descriptor for an sg device, from the pool or opened now,
+ * and hold it for one command.  *reusedp is set if it was in the pool.
+ * Returns NULL with errno set if the device can't be opened.
+ */
+static struct sg_pool_entry *
+sg_pool_get(const char *file, int *reusedp)
+{
+	struct sg_pool_entry *ep;
+	struct sg_pool_entry *new;
+
+	pthread_mutex_lock(&sg_pool_lock);
+	ep = sg_pool_find(file);
+	*reusedp = (ep != NULL);
+	if (ep == NULL) {
+		pthread_mutex_unlock(&sg_pool_lock);
+		new = sg_pool_open(file);
+		if (new == NULL)
+			return NULL;
+		pthread_mutex_lock(&sg_pool_lock);
+		ep = sg_pool_find(file);        /* opened meanwhile? */
+		if (ep != NULL) {
+			sg_pool_free(new);
+		} else if (strlen(file) >= sizeof(new->se_path)) {
+			new->se_dead = 1;       /* name too long to keep */
+			ep = new;
+		} else {
+			ep = new;
+			sg_pool_add(ep);
+		}
+	} else if (ep != sg_pool_head) {
+		sg_pool_list_del(ep);
+		sg_pool_link(ep);
+	}
+	ep->se_users++;
+	pthread_mutex_unlock(&sg_pool_lock);
+	pthread_mutex_lock(&ep->se_lock);
+	return ep;
+}
+
+/*
+ * Release a descriptor after a command.  If the command failed, the
+ * descriptor may be for a device that's gone, so it isn't kept.
+ */
+static void
+sg_pool_put(struct sg_pool_entry *ep, int failed)
+{
+	pthread_mutex_unlock(&ep->se_lock);
+	pthread_mutex_lock(&sg_pool_lock);
+	if (failed)
+		sg_pool_unlink(ep);
+	ep->se_used = sg_pool_now();
+	if (--ep->se_users == 0 && ep->se_dead)
+		sg_pool_free(ep);
+	pthread_mutex_unlock(&sg_pool_lock);
+}
+
+/*
+ * Close the pooled descriptor of an sg device that's gone.
+ * A command using it finishes first.
+ */
+void
+sg_pool_forget(const char *file)
+{
+	struct sg_pool_entry *ep;
+
+	pthread_mutex_lock(&sg_pool_lock);
+	ep = sg_pool_find(file);
+	if (ep != NULL)
+		sg_pool_drop(ep);
+	pthread_mutex_unlock(&sg_pool_lock);
+}
+
+/*
+ * Close all pooled descriptors, as when the devices may have changed.
+ */
+void
+sg_pool_flush(void)
+{
+	pthread_mutex_lock(&sg_pool_lock);
+	while (sg_pool_head != NULL)
+		sg_pool_drop(sg_pool_head);
+	pthread_mutex_unlock(&sg_pool_lock);
+}
+
+/*
+ * Stop the reaper and close all pooled descriptors, when the library is
+ * freed.
+ */
+void
+sg_pool_destroy(void)
+{
+	int reaping;
+
+	pthread_mutex_lock(&sg_pool_lock);
+	reaping = sg_pool_reaping;
+	sg_pool_stop = 1;
+	if (reaping)
+		pthread_cond_signal(&sg_pool_cond);
+	pthread_mutex_unlock(&sg_pool_lock);
+	if (reaping) {
+		pthread_join(sg_pool_reaper, NULL);
+		pthread_cond_destroy(&sg_pool_cond);
+	}
+	sg_pool_flush();
+	sg_pool_reaping = 0;
+	sg_pool_stop = 0;
+}
+
+/*
+ * Issue SG_IO to an sg device on a pooled descriptor.
+ * A pooled descriptor may be for a device that was removed, and maybe
+ * replaced under the same name, so if it reports no device the command
+ * is tried once more on a fresh one.
+ * Returns 0, or -1 if the device couldn't be opened or SG_IO failed.
+ */
+static int
+sg_io(const char *func, const char *file, struct sg_io_hdr *hdrp)
+{
+	struct sg_pool_entry *ep;
+	int reused;
+	int rc;
+
+	do {
+		ep = sg_pool_get(file, &reused);
+		if (ep == NULL) {
+			fprintf(stderr, "%s: open of %s failed, errno=0x%x\n",
+				func, file, errno);
+			return -1;
+		}
+		rc = ioctl(ep->se_fd, SG_IO, hdrp);
+		if (rc < 0)
+			rc = errno;
+		sg_pool_put(ep, rc != 0);
+	} while (reused && (rc == ENODEV || rc == ENXIO || rc == EBADF));
+	if (rc != 0) {
+		fprintf(stderr, "%s: SG_IO error. file %s, errno=0x%x\n",
+			func, file, rc);
+		return -1;
+	}
+	return 0;
+}
+
 /*
  * Perform INQUIRY of SCSI-generic device.
  */
@@ -34,8 +393,6 @@ sg_issue_inquiry(const char *file, HBA_UINT8 cdb_byte1,
 	struct scsi_inquiry cmd;
 	size_t len;
 	HBA_UINT32 slen;
-	int fd;
-	int rc;
 
 	len = *lenp;
 	slen = *sense_lenp;
@@ -45,12 +402,6 @@ sg_issue_inquiry(const char *file, HBA_UINT8 cdb_byte1,
 		len = 255;    /* sometimes must fit in 8-byte field */
 	*lenp = 0;
 	*statp = 0;
-	fd = open(file, O_RDWR);
-	if (fd < 0) {
-		fprintf(stderr, "%s: open of %s failed, errno=0x%x\n",
-			__func__, file, errno);
-		return HBA_STATUS_ERROR;
-	}
 	memset(&hdr, 0, sizeof(hdr));
 	memset(&cmd, 0, sizeof(cmd));
 	memset(buf, 0, len);
@@ -70,15 +421,8 @@ sg_issue_inquiry(const char *file, HBA_UINT8 cdb_byte1,
 	hdr.sbp = (unsigned char *) sense;
 	hdr.timeout = 3000;                     /* mS to wait for result */
 
-	rc = ioctl(fd, SG_IO, &hdr);
-	if (rc < 0) {
-		rc = errno;
-		fprintf(stderr, "%s: SG_IO error. file %s, errno=0x%x\n",
-			__func__, file, errno);
-		close(fd);
+	if (sg_io(__func__, file, &hdr) != 0)
 		return HBA_STATUS_ERROR;
-	}
-	close(fd);
 	*lenp = len - hdr.resid;
 	*sense_lenp = hdr.sb_len_wr;
 	*statp = hdr.status;
@@ -169,17 +513,9 @@ sg_issue_read_capacity(const char *file, void *resp, HBA_UINT32 *resp_lenp,
 	struct scsi_rcap10 cmd;
 	struct scsi_rcap16 cmd_16;
 	size_t len;
-	int fd;
-	int rc;
 
 	len = *resp_lenp;
 	*resp_lenp = 0;
-	fd = open(file, O_RDWR);
-	if (fd < 0) {
-		fprintf(stderr, "%s: open of %s failed, errno=0x%x\n",
-			__func__, file, errno);
-		return errno;
-	}
 	memset(&hdr, 0, sizeof(hdr));
 
 	/* If the response buffer size is enough to
@@ -210,15 +546,8 @@ sg_issue_read_capacity(const char *file, void *resp, HBA_UINT32 *resp_lenp,
 	hdr.timeout = UINT_MAX;
 	hdr.timeout = 3000;                     /* mS to wait for result */
 
-	rc = ioctl(fd, SG_IO, &hdr);
-	if (rc < 0) {
-		rc = errno;
-		fprintf(stderr, "%s: SG_IO error. file %s, errno=0x%x\n",
-			__func__, file, errno);
-		close(fd);
+	if (sg_io(__func__, file, &hdr) != 0)
 		return HBA_STATUS_ERROR;
-	}
-	close(fd);
 	*resp_lenp = len - hdr.resid;
 	*sense_lenp = hdr.sb_len_wr;
 	*statp = hdr.status;
@@ -235,17 +564,9 @@ sg_issue_report_luns(const char *file, void *resp, HBA_UINT32 *resp_lenp,
 	struct sg_io_hdr hdr;
 	struct scsi_report_luns cmd;
 	size_t len;
-	int fd;
-	int rc;
 
 	len = *resp_lenp;
 	*resp_lenp = 0;
-	fd = open(file, O_RDWR);
-	if (fd < 0) {
-		fprintf(stderr, "%s: open of %s failed, errno=0x%x\n",
-			__func__, file, errno);
-		return errno;
-	}
 	memset(&hdr, 0, sizeof(hdr));
 	memset(&cmd, 0, sizeof(cmd));
 
@@ -263,15 +584,8 @@ sg_issue_report_luns(const char *file, void *resp, HBA_UINT32 *resp_lenp,
 	hdr.timeout = UINT_MAX;
 	hdr.timeout = 3000;                     /* mS to wait for result */
 
-	rc = ioctl(fd, SG_IO, &hdr);
-	if (rc < 0) {
-		rc = errno;
-		fprintf(stderr, "%s: SG_IO error. file %s, errno=0x%x\n",
-			__func__, file, errno);
-		close(fd);
+	if (sg_io(__func__, file, &hdr) != 0)
 		return HBA_STATUS_ERROR;
-	}
-	close(fd);
 	*resp_lenp = len - hdr.resid;
 	*sense_lenp = hdr.sb_len_wr;
 	*statp = hdr.status;
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2008, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Kernel uevents for SCSI devices.
+ *
+ * A thread reads uevents and queues those for SCSI devices and their
+ * sg and block devices.  The queue is drained by library calls through
+ * uevent_next(), so the caches are only changed by the calling thread.
+ */
+
+#include "utils.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include "uevent_impl.h"
+
+#define UEVENT_QUEUE_MAX        4096    /* events kept before dropping */
+#define UEVENT_MSG_LEN          8192
+#define UEVENT_RCVBUF           (1024 * 1024)
+
+struct uevent_entry {
+	struct uevent_entry     *ue_next;
+	struct uevent           ue_event;
+};
+
+static struct uevent_entry *uevent_head;
+static struct uevent_entry **uevent_tail = &uevent_head;
+static u_int32_t uevent_count;
+static int uevent_lost;                 /* events dropped */
+static volatile int uevent_pending;     /* something to drain */
+static pthread_mutex_t uevent_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t uevent_thread;
+static int uevent_running;
+static int uevent_fd = -1;
+static int uevent_stop_pipe[2] = { -1, -1 };
+
+static struct sa_nameval uevent_subsys_table[] = {
+	{ "scsi_device",        UEVENT_SUB_SCSI_DEVICE },
+	{ "scsi_generic",       UEVENT_SUB_SCSI_GENERIC },
+	{ "block",              UEVENT_SUB_BLOCK },
+	{ NULL,                 0 }
+};
+
+static struct sa_nameval uevent_action_table[] = {
+	{ "add",                UEVENT_ACT_ADD },
+	{ "remove",             UEVENT_ACT_REMOVE },
+	{ "change",             UEVENT_ACT_CHANGE },
+	{ NULL,                 0 }
+};
+
+/*
+ * Find the H:C:T:L component of a device path.
+ * The SCSI device's own path ends in H:C:T:L, its scsi_device's in
+ * H:C:T:L/scsi_device/H:C:T:L, and its sg and block devices' in
+ * H:C:T:L/scsi_generic/sgN or H:C:T:L/block/sdX.
+ */
+static int
+uevent_parse_hctl(const char *path, struct uevent *up)
+{
+	const char *cp;
+	int len;
+
+	for (cp = path; cp != NULL; cp = strchr(cp, '/')) {
+		cp++;
+		len = 0;
+		if (sscanf(cp, "%u:%u:%u:%u%n", &up->ue_hba, &up->ue_channel,
+			   &up->ue_target, &up->ue_lun, &len) == 4 &&
+		    (cp[len] == '/' || cp[len] == '\0'))
+			return 0;
+	}
+	return -1;
+}
+
+/*
+ * Parse a kernel uevent message: "action@devpath" followed by
+ * KEY=value strings, all NUL-terminated.
+ * Returns -1 for messages not of interest.
+ */
+static int
+uevent_parse(char *msg, size_t len, struct uevent *up)
+{
+	char *cp;
+	char *end = msg + len;
+	char *action = NULL;
+	char *devpath = NULL;
+	char *subsys = NULL;
+	char *devname = NULL;
+	char *devtype = NULL;
+	u_int32_t val;
+
+	memset(up, 0, sizeof(*up));
+	if (len == 0 || strchr(msg, '@') == NULL)
+		return -1;              /* not from the kernel */
+	msg[len - 1] = '\0';
+	for (cp = msg + strlen(msg) + 1; cp < end; cp += strlen(cp) + 1) {
+		if (strncmp(cp, "ACTION=", 7) == 0)
+			action = cp + 7;
+		else if (strncmp(cp, "DEVPATH=", 8) == 0)
+			devpath = cp + 8;
+		else if (strncmp(cp, "SUBSYSTEM=", 10) == 0)
+			subsys = cp + 10;
+		else if (strncmp(cp, "DEVNAME=", 8) == 0)
+			devname = cp + 8;
+		else if (strncmp(cp, "DEVTYPE=", 8) == 0)
+			devtype = cp + 8;
+		else if (strcmp(cp, "SDEV_UA=INQUIRY_DATA_HAS_CHANGED") == 0)
+			up->ue_inq_changed = 1;
+	}
+	if (action == NULL || devpath == NULL || subsys == NULL)
+		return -1;
+	if (strcmp(subsys, "scsi") == 0 && devtype != NULL &&
+	    strcmp(devtype, "scsi_device") == 0)
+		val = UEVENT_SUB_SCSI_DEVICE;   /* the device itself: SDEV_UA */
+	else if (sa_enum_encode(uevent_subsys_table, subsys, &val) != 0)
+		return -1;
+	up->ue_subsys = val;
+	if (sa_enum_encode(uevent_action_table, action, &val) != 0)
+		return -1;
+	up->ue_action = val;
+	if (up->ue_subsys == UEVENT_SUB_BLOCK &&
+	    (devtype == NULL || strcmp(devtype, "disk") != 0))
+		return -1;              /* partitions */
+	if (uevent_parse_hctl(devpath, up) != 0)
+		return -1;
+	if (devname == NULL) {
+		devname = strrchr(devpath, '/');
+		devname = devname ? devname + 1 : devpath;
+	}
+	sa_strncpy_safe(up->ue_name, sizeof(up->ue_name),
+			devname, strlen(devname) + 1);
+	return 0;
+}
+
+static void
+uevent_queue(const struct uevent *up)
+{
+	struct uevent_entry *ep;
+
+	pthread_mutex_lock(&uevent_lock);
+	ep = NULL;
+	if (uevent_count < UEVENT_QUEUE_MAX)
+		ep = malloc(sizeof(*ep));
+	if (ep == NULL) {
+		uevent_lost = 1;
+	} else {
+		ep->ue_next = NULL;
+		ep->ue_event = *up;
+		*uevent_tail = ep;
+		uevent_tail = &ep->ue_next;
+		uevent_count++;
+	}
+	uevent_pending = 1;
+	pthread_mutex_unlock(&uevent_lock);
+}
+
+/*
+ * Get the next queued uevent.
+ * Returns 0 if there is none.  If events were dropped, a single
+ * UEVENT_ACT_LOST event replaces those queued.
+ */
+int
+uevent_next(struct uevent *up)
+{
+	struct uevent_entry *ep;
+	int rc = 0;
+
+	if (!uevent_pending)
+		return 0;
+	pthread_mutex_lock(&uevent_lock);
+	if (uevent_lost) {
+		while ((ep = uevent_head) != NULL) {
+			uevent_head = ep->ue_next;
+			free(ep);
+		}
+		uevent_tail = &uevent_head;
+		uevent_count = 0;
+		uevent_lost = 0;
+		memset(up, 0, sizeof(*up));
+		up->ue_action = UEVENT_ACT_LOST;
+		rc = 1;
+	} else if ((ep = uevent_head) != NULL) {
+		uevent_head = ep->ue_next;
+		if (uevent_head == NULL)
+			uevent_tail = &uevent_head;
+		uevent_count--;
+		*up = ep->ue_event;
+		free(ep);
+		rc = 1;
+	}
+	uevent_pending = (uevent_head != NULL);
+	pthread_mutex_unlock(&uevent_lock);
+	return rc;
+}
+
+static void *
+uevent_reader(void *arg)
+{
+	struct pollfd fds[2];
+	struct uevent event;
+	char msg[UEVENT_MSG_LEN];
+	ssize_t len;
+
+	fds[0].fd = uevent_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = uevent_stop_pipe[0];
+	fds[1].events = POLLIN;
+	for (;;) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents)
+			break;
+		len = recv(uevent_fd, msg, sizeof(msg), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == ENOBUFS) {
+				pthread_mutex_lock(&uevent_lock);
+				uevent_lost = 1;
+				uevent_pending = 1;
+				pthread_mutex_unlock(&uevent_lock);
+				continue;
+			}
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			break;
+		}
+		if (len == 0)
+			break;                  /* other end closed */
+		if (uevent_parse(msg, len, &event) == 0)
+			uevent_queue(&event);
+	}
+	return NULL;
+}
+
+/*
+ * Open the kernel's uevent netlink socket.
+ */
+static int
+uevent_open(void)
+{
+	struct sockaddr_nl addr;
+	int size = UEVENT_RCVBUF;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;             /* kernel events */
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Start reading uevent messages from fd, which is closed by uevent_stop().
+ * Tests pass one end of a socketpair here.
+ */
+int
+uevent_start_fd(int fd)
+{
+	if (uevent_running) {
+		close(fd);
+		return 0;
+	}
+	if (pipe2(uevent_stop_pipe, O_CLOEXEC) < 0) {
+		close(fd);
+		return -1;
+	}
+	uevent_fd = fd;
+	if (pthread_create(&uevent_thread, NULL, uevent_reader, NULL) != 0) {
+		fprintf(stderr, "%s: thread create failed\n", __func__);
+		close(uevent_stop_pipe[0]);
+		close(uevent_stop_pipe[1]);
+		close(fd);
+		uevent_stop_pipe[0] = -1;
+		uevent_stop_pipe[1] = -1;
+		uevent_fd = -1;
+		return -1;
+	}
+	uevent_running = 1;
+	return 0;
+}
+
+/*
+ * Start reading uevents from the kernel's uevent socket.
+ */
+int
+uevent_start(void)
+{
+	int fd;
+
+	if (uevent_running)
+		return 0;
+	fd = uevent_open();
+	if (fd < 0) {
+		fprintf(stderr, "%s: uevent socket failed, errno=0x%x\n",
+			__func__, errno);
+		return -1;
+	}
+	return uevent_start_fd(fd);
+}
+
+/*
+ * Tell whether uevents are being read.
+ */
+int
+uevent_active(void)
+{
+	return uevent_running;
+}
+
+/*
+ * Stop reading uevents and drop any not yet taken.
+ */
+void
+uevent_stop(void)
+{
+	struct uevent event;
+
+	if (!uevent_running)
+		return;
+	if (write(uevent_stop_pipe[1], "", 1) < 0)
+		fprintf(stderr, "%s: stop failed, errno=0x%x\n",
+			__func__, errno);
+	pthread_join(uevent_thread, NULL);
+	close(uevent_stop_pipe[0]);
+	close(uevent_stop_pipe[1]);
+	close(uevent_fd);
+	uevent_stop_pipe[0] = -1;
+	uevent_stop_pipe[1] = -1;
+	uevent_fd = -1;
+	uevent_running = 0;
+	while (uevent_next(&event))
+		;
+}
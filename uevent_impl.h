@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2008, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef _UEVENT_IMPL_H_
+#define _UEVENT_IMPL_H_
+
+#define UEVENT_NAME_LEN         32
+
+/*
+ * A kernel uevent for a SCSI device, or its sg or block device.
+ */
+struct uevent {
+	int             ue_action;      /* UEVENT_ACT_* */
+	int             ue_subsys;      /* UEVENT_SUB_* */
+	u_int32_t       ue_hba;         /* H:C:T:L of the SCSI device */
+	u_int32_t       ue_channel;
+	u_int32_t       ue_target;
+	u_int32_t       ue_lun;
+	int             ue_inq_changed; /* unit attention: inquiry changed */
+	char            ue_name[UEVENT_NAME_LEN]; /* sg or block device */
+};
+
+#define UEVENT_ACT_ADD          1
+#define UEVENT_ACT_REMOVE       2
+#define UEVENT_ACT_CHANGE       3
+#define UEVENT_ACT_LOST         4       /* events were dropped */
+
+#define UEVENT_SUB_SCSI_DEVICE  1
+#define UEVENT_SUB_SCSI_GENERIC 2
+#define UEVENT_SUB_BLOCK        3
+
+int uevent_start(void);
+int uevent_start_fd(int);
+void uevent_stop(void);
+int uevent_active(void);
+int uevent_next(struct uevent *);
+
+#endif /* _UEVENT_IMPL_H_ */
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2008, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Feed kernel-format uevent messages through a socketpair to the uevent
+ * reader, and check the events queued for the library.
+ */
+
+#include "utils.h"
+#include <sys/socket.h>
+#include "uevent_impl.h"
+
+#define UEVENT_TEST_WAIT        2000    /* milliseconds for an event */
+
+#define UEVENT_TEST_RPORT       "/devices/pci0000:00/0000:00:03.0/host4/" \
+				"rport-4:0-2/target4:0:1"
+
+static int uevent_test_fd = -1;         /* our end of the socketpair */
+static volatile int uevent_test_nobufs; /* fail the next recv() */
+
+/*
+ * Stands in for the C library's recv(), so the reader can be shown a
+ * receive buffer overrun, as the kernel socket reports it.
+ */
+ssize_t
+recv(int fd, void *buf, size_t len, int flags)
+{
+	if (uevent_test_nobufs) {
+		uevent_test_nobufs = 0;
+		errno = ENOBUFS;
+		return -1;
+	}
+	return recvfrom(fd, buf, len, flags, NULL, NULL);
+}
+
+/*
+ * Send a message made of the header and KEY=value strings given,
+ * each NUL-terminated, as the kernel does.
+ */
+static void
+uevent_test_send(const char *str, ...)
+{
+	va_list ap;
+	char msg[1024];
+	size_t len = 0;
+
+	va_start(ap, str);
+	for (; str != NULL; str = va_arg(ap, const char *)) {
+		len += snprintf(msg + len, sizeof(msg) - len, "%s", str) + 1;
+		if (len >= sizeof(msg))
+			break;
+	}
+	va_end(ap);
+	if (send(uevent_test_fd, msg, len, 0) != (ssize_t) len) {
+		fprintf(stderr, "%s: send failed, errno=0x%x\n",
+			__func__, errno);
+		exit(1);
+	}
+}
+
+/*
+ * Wait for the next queued event.
+ */
+static int
+uevent_test_next(struct uevent *up)
+{
+	int i;
+
+	for (i = 0; i < UEVENT_TEST_WAIT; i++) {
+		if (uevent_next(up))
+			return 0;
+		usleep(1000);
+	}
+	return -1;
+}
+
+static int
+uevent_test_check(const char *what, int action, int subsys,
+		  u_int32_t lun, const char *name, int inq_changed)
+{
+	struct uevent event;
+
+	if (uevent_test_next(&event) != 0) {
+		fprintf(stderr, "%s: %s: no event\n", __func__, what);
+		return 1;
+	}
+	if (event.ue_action != action || event.ue_subsys != subsys ||
+	    (action != UEVENT_ACT_LOST &&
+	     (event.ue_hba != 4 || event.ue_channel != 0 ||
+	      event.ue_target != 1 || event.ue_lun != lun ||
+	      strcmp(event.ue_name, name) != 0)) ||
+	    event.ue_inq_changed != inq_changed) {
+		fprintf(stderr, "%s: %s: got action %d subsys %d "
+			"%u:%u:%u:%u name \"%s\" inq_changed %d\n",
+			__func__, what, event.ue_action, event.ue_subsys,
+			event.ue_hba, event.ue_channel, event.ue_target,
+			event.ue_lun, event.ue_name, event.ue_inq_changed);
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct uevent event;
+	int fds[2];
+	int errors = 0;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0) {
+		fprintf(stderr, "%s: socketpair failed, errno=0x%x\n",
+			__func__, errno);
+		return 1;
+	}
+	uevent_test_fd = fds[0];
+	if (uevent_start_fd(fds[1]) != 0)
+		return 1;
+
+	uevent_test_send("add@" UEVENT_TEST_RPORT "/4:0:1:3",
+			 "ACTION=add",
+			 "DEVPATH=" UEVENT_TEST_RPORT
+			 "/4:0:1:3/scsi_device/4:0:1:3",
+			 "SUBSYSTEM=scsi_device",
+			 "SEQNUM=1001",
+			 NULL);
+	errors += uevent_test_check("add scsi_device", UEVENT_ACT_ADD,
+				    UEVENT_SUB_SCSI_DEVICE, 3, "4:0:1:3", 0);
+
+	/* a partition, then a message not from the kernel: both dropped */
+	uevent_test_send("add@" UEVENT_TEST_RPORT "/4:0:1:3/block/sdc/sdc1",
+			 "ACTION=add",
+			 "DEVPATH=" UEVENT_TEST_RPORT "/4:0:1:3/block/sdc/sdc1",
+			 "SUBSYSTEM=block",
+			 "DEVNAME=sdc1",
+			 "DEVTYPE=partition",
+			 NULL);
+	uevent_test_send("libudev",
+			 "ACTION=add",
+			 "DEVPATH=" UEVENT_TEST_RPORT "/4:0:1:3/block/sdc",
+			 "SUBSYSTEM=block",
+			 "DEVNAME=sdc",
+			 "DEVTYPE=disk",
+			 NULL);
+	uevent_test_send("add@" UEVENT_TEST_RPORT "/4:0:1:3/block/sdc",
+			 "ACTION=add",
+			 "DEVPATH=" UEVENT_TEST_RPORT "/4:0:1:3/block/sdc",
+			 "SUBSYSTEM=block",
+			 "DEVNAME=sdc",
+			 "DEVTYPE=disk",
+			 NULL);
+	errors += uevent_test_check("add block", UEVENT_ACT_ADD,
+				    UEVENT_SUB_BLOCK, 3, "sdc", 0);
+
+	uevent_test_send("remove@" UEVENT_TEST_RPORT
+			 "/4:0:1:3/scsi_generic/sg7",
+			 "ACTION=remove",
+			 "DEVPATH=" UEVENT_TEST_RPORT
+			 "/4:0:1:3/scsi_generic/sg7",
+			 "SUBSYSTEM=scsi_generic",
+			 "DEVNAME=sg7",
+			 NULL);
+	errors += uevent_test_check("remove scsi_generic", UEVENT_ACT_REMOVE,
+				    UEVENT_SUB_SCSI_GENERIC, 3, "sg7", 0);
+
+	/* the target on the same bus isn't a SCSI device */
+	uevent_test_send("change@" UEVENT_TEST_RPORT,
+			 "ACTION=change",
+			 "DEVPATH=" UEVENT_TEST_RPORT,
+			 "SUBSYSTEM=scsi",
+			 "DEVTYPE=scsi_target",
+			 NULL);
+
+	/* the unit attention, as sent on the SCSI device itself */
+	uevent_test_send("change@" UEVENT_TEST_RPORT "/4:0:1:5",
+			 "ACTION=change",
+			 "DEVPATH=" UEVENT_TEST_RPORT "/4:0:1:5",
+			 "SUBSYSTEM=scsi",
+			 "DEVTYPE=scsi_device",
+			 "DRIVER=sd",
+			 "SDEV_UA=INQUIRY_DATA_HAS_CHANGED",
+			 "SEQNUM=1005",
+			 NULL);
+	errors += uevent_test_check("change with UA", UEVENT_ACT_CHANGE,
+				    UEVENT_SUB_SCSI_DEVICE, 5, "4:0:1:5", 1);
+
+	/* an overrun of the receive buffer drops what's queued */
+	uevent_test_nobufs = 1;
+	uevent_test_send("remove@" UEVENT_TEST_RPORT "/4:0:1:3/block/sdc",
+			 "ACTION=remove",
+			 "DEVPATH=" UEVENT_TEST_RPORT "/4:0:1:3/block/sdc",
+			 "SUBSYSTEM=block",
+			 "DEVNAME=sdc",
+			 "DEVTYPE=disk",
+			 NULL);
+	errors += uevent_test_check("ENOBUFS", UEVENT_ACT_LOST, 0, 0, "", 0);
+	while (uevent_test_next(&event) == 0) {
+		if (event.ue_action != UEVENT_ACT_REMOVE ||
+		    event.ue_subsys != UEVENT_SUB_BLOCK) {
+			fprintf(stderr, "%s: unexpected event action %d "
+				"subsys %d\n", __func__, event.ue_action,
+				event.ue_subsys);
+			errors++;
+		}
+	}
+
+	uevent_stop();
+	close(uevent_test_fd);
+	if (errors)
+		fprintf(stderr, "%s: %d failures\n", __func__, errors);
+	return errors != 0;
+}
@@ -228,7 +228,32 @@ sa_dir_read(char *dir_name, int (*func)(struct dirent *dp, void *), void *arg)
  */
 #define SA_LOG_BUF_LEN  200	/* on-stack line buffer size */
 
-static const u_int32_t sa_table_growth = 16;        /* entries to grow by */
+static const u_int32_t sa_table_min_size = 16;      /* initial entries */
+
+/** sa_table_reserve(tp, size) - make room for at least size entries.
+ *
+ * @param tp pointer to sa_table structure.
+ * @param size number of entries to allocate space for.
+ * @returns 0 on success, or -1 if table couldn't be grown.
+ *
+ * This doesn't change st_limit.  Callers which know how many entries
+ * they'll add can use this to avoid repeated reallocation.
+ */
+int
+sa_table_reserve(struct sa_table *tp, u_int32_t size)
+{
+	void **ap;
+
+	if (size <= tp->st_size)
+		return 0;
+	ap = realloc(tp->st_table, size * sizeof(*ap));
+	if (ap == NULL)
+		return -1;
+	memset(ap + tp->st_size, 0, (size - tp->st_size) * sizeof(*ap));
+	tp->st_table = ap;
+	tp->st_size = size;
+	return 0;
+}
 
 /** sa_table_grow(tp, index) - add space to a table for index.
  *
@@ -236,6 +261,9 @@ static const u_int32_t sa_table_growth = 16;        /* entries to grow by */
  * @param index - new index past the end of the current table.
  * @returns new index, or -1 if table couldn't be grown.
  *
+ * The allocation at least doubles each time it is grown, so appending
+ * N entries costs O(N) copying overall.
+ *
  * Note: if the table has never been used, and is still all zero, this works.
  *
  * Note: perhaps not safe for multithreading.  Caller can lock the table
@@ -246,22 +274,41 @@ int
 sa_table_grow(struct sa_table *tp, u_int32_t index)
 {
 	u_int32_t new_size;
-	void **ap;
 
 	if (index >= tp->st_size) {
-		new_size = index + sa_table_growth;
-		ap = realloc(tp->st_table, new_size * sizeof(*ap));
-		if (ap == NULL)
+		new_size = tp->st_size * 2;
+		if (new_size < sa_table_min_size)
+			new_size = sa_table_min_size;
+		if (new_size <= index)
+			new_size = index + 1;
+		if (sa_table_reserve(tp, new_size) < 0)
 			return -1;
-		memset(ap + tp->st_size, 0,
-			(new_size - tp->st_size) * sizeof(*ap));
-		tp->st_table = ap;
-		tp->st_size = new_size;
 	}
 	tp->st_limit = index + 1;
 	return index;
 }
 
+/** sa_table_compact(tp) - remove holes from a table.
+ *
+ * @param tp pointer to sa_table structure.
+ *
+ * Entries are moved down, keeping their order, so that afterwards
+ * st_limit equals st_count.  Entry indexes change.
+ */
+void
+sa_table_compact(struct sa_table *tp)
+{
+	u_int32_t i;
+	u_int32_t j = 0;
+	void *ep;
+
+	sa_table_foreach(tp, i, ep)
+		tp->st_table[j++] = ep;
+	memset(tp->st_table + j, 0, (tp->st_limit - j) * sizeof(void *));
+	tp->st_limit = j;
+	tp->st_count = j;
+}
+
 /** sa_table_destroy(tp) - free memory used by table.
  *
  * @param tp pointer to sa_table structure.
@@ -275,6 +322,7 @@ sa_table_destroy(struct sa_table *tp)
 	}
 	tp->st_limit = 0;
 	tp->st_size = 0;
+	tp->st_count = 0;
 }
 
 /** sa_table_destroy_all(tp) - free memory used by table, including entries.
@@ -284,66 +332,283 @@ sa_table_destroy(struct sa_table *tp)
 void
 sa_table_destroy_all(struct sa_table *tp)
 {
-	int  i;
+	u_int32_t i;
+	void *ep;
 
-	if (tp->st_table) {
-		for (i = 0; i < tp->st_limit; i++) {
-			if (tp->st_table[i]) {
-				free(tp->st_table[i]);
-				tp->st_table[i] = NULL;
-			}
-		}
-	}
+	sa_table_foreach(tp, i, ep)
+		free(ep);
 	sa_table_destroy(tp);
 }
 
-/** sa_table_iterate(tp, handler, arg)
+static const size_t sa_arena_chunk_size = 64 * 1024;   /* default chunk */
+static const size_t sa_arena_align = 16;
+
+/*
+ * Offset of the usable space in a chunk.
+ */
+#define SA_ARENA_HDR_LEN \
+	((sizeof(struct sa_arena_chunk) + 15) & ~(size_t) 15)
+
+/** sa_arena_alloc(arp, len) - allocate zeroed memory from an arena.
  *
- * @param tp pointer to sa_table structure.
- * @param handler function to be called for each non-NULL entry.
- * @param arg argument for function.
+ * @param arp pointer to sa_arena structure.
+ * @param len number of bytes needed.
+ * @returns pointer to the memory, or NULL if malloc failed.
+ *
+ * The memory is aligned for any of our structures.
+ * Requests larger than a chunk get a chunk of their own.
  */
-void
-sa_table_iterate(struct sa_table *tp,
-		 void (*handler)(void *ep, void *arg),
-		 void *arg)
+void *
+sa_arena_alloc(struct sa_arena *arp, size_t len)
 {
-	int i;
+	struct sa_arena_chunk *cp = arp->ar_chunks;
+	size_t size;
 	void *ep;
 
-	for (i = 0; i < tp->st_limit; i++) {
-		ep = tp->st_table[i];
-		if (ep != NULL)
-			(*handler)(ep, arg);
+	len = (len + sa_arena_align - 1) & ~(sa_arena_align - 1);
+	if (cp == NULL || cp->ac_size - cp->ac_used < len) {
+		size = len > sa_arena_chunk_size ? len : sa_arena_chunk_size;
+		cp = malloc(SA_ARENA_HDR_LEN + size);
+		if (cp == NULL)
+			return NULL;
+		cp->ac_next = arp->ar_chunks;
+		cp->ac_base = arp->ar_in_use;
+		cp->ac_size = size;
+		cp->ac_used = 0;
+		arp->ar_chunks = cp;
+		arp->ar_size += SA_ARENA_HDR_LEN + size;
 	}
+	ep = (char *) cp + SA_ARENA_HDR_LEN + cp->ac_used;
+	cp->ac_used += len;
+	arp->ar_in_use += len;
+	memset(ep, 0, len);
+	return ep;
 }
 
-/** sa_table_search(tp, match, arg)
+/** sa_arena_unwind(arp, mark) - give back everything allocated after mark.
  *
- * @param tp pointer to sa_table structure.
- * @param match function to compare entries with arg and
- *	 return non-NULL if match.
- * @param arg argument for match function.
+ * @param arp pointer to sa_arena structure.
+ * @param mark value from sa_arena_mark().
  *
- * Note that the value found could actually be something not in the table
- * if the match function is doing something clever, like returning a
- * sub-structure of the table entry.
+ * This is for error paths that built a partial object.  Chunks that
+ * become unused are freed.
+ */
+void
+sa_arena_unwind(struct sa_arena *arp, size_t mark)
+{
+	struct sa_arena_chunk *cp;
+
+	while ((cp = arp->ar_chunks) != NULL && cp->ac_base >= mark &&
+	       cp->ac_base + cp->ac_used > mark) {
+		arp->ar_chunks = cp->ac_next;
+		arp->ar_size -= SA_ARENA_HDR_LEN + cp->ac_size;
+		free(cp);
+	}
+	if (cp != NULL && cp->ac_base + cp->ac_used > mark)
+		cp->ac_used = mark - cp->ac_base;
+	if (mark < arp->ar_in_use)
+		arp->ar_in_use = mark;
+}
+
+/** sa_arena_release(arp) - free all memory in an arena.
+ *
+ * @param arp pointer to sa_arena structure.
+ */
+void
+sa_arena_release(struct sa_arena *arp)
+{
+	struct sa_arena_chunk *cp;
+
+	while ((cp = arp->ar_chunks) != NULL) {
+		arp->ar_chunks = cp->ac_next;
+		free(cp);
+	}
+	sa_arena_init(arp);
+}
+
+char sa_hash_deleted[1];
+
+static const u_int32_t sa_hash_min_size = 16;       /* initial slot count */
+
+/*
+ * Re-hash all live entries into a new slot array of the given size.
+ */
+static int
+sa_hash_resize(struct sa_hash *hp, u_int32_t new_size)
+{
+	struct sa_hash_slot *old = hp->sh_slots;
+	struct sa_hash_slot *sp;
+	struct sa_hash_slot *np;
+	u_int32_t old_size = hp->sh_size;
+	u_int32_t mask = new_size - 1;
+	u_int32_t i;
+	u_int32_t j;
+
+	np = calloc(new_size, sizeof(*np));
+	if (np == NULL)
+		return -1;
+	for (i = 0; i < old_size; i++) {
+		sp = &old[i];
+		if (sp->hs_ep == NULL || sp->hs_ep == sa_hash_deleted)
+			continue;
+		for (j = sa_hash_mix(sp->hs_key) & mask; np[j].hs_ep != NULL;
+		     j = (j + 1) & mask)
+			;
+		np[j] = *sp;
+	}
+	free(old);
+	hp->sh_slots = np;
+	hp->sh_size = new_size;
+	hp->sh_used = hp->sh_count;
+	return 0;
+}
+
+/** sa_hash_insert(hp, key, ep) - replace or insert an entry.
+ *
+ * @param hp pointer to sa_hash structure.
+ * @param key the key for the entry.
+ * @param ep entry pointer, must not be NULL.
+ * @returns 0 on success, or -1 if the table couldn't be grown.
+ *
+ * The table is kept at most 3/4 full, counting deleted slots.
+ */
+int
+sa_hash_insert(struct sa_hash *hp, u_int64_t key, void *ep)
+{
+	struct sa_hash_slot *sp;
+	struct sa_hash_slot *free_sp = NULL;
+	u_int32_t new_size;
+	u_int32_t mask;
+	u_int32_t i;
+
+	if ((hp->sh_used + 1) * 4 > hp->sh_size * 3) {
+		new_size = hp->sh_size ? hp->sh_size : sa_hash_min_size;
+		while ((hp->sh_count + 1) * 2 > new_size)
+			new_size *= 2;
+		if (sa_hash_resize(hp, new_size) < 0)
+			return -1;
+	}
+	mask = hp->sh_size - 1;
+	for (i = sa_hash_mix(key) & mask; ; i = (i + 1) & mask) {
+		sp = &hp->sh_slots[i];
+		if (sp->hs_ep == NULL)
+			break;
+		if (sp->hs_ep == sa_hash_deleted) {
+			if (free_sp == NULL)
+				free_sp = sp;
+		} else if (sp->hs_key == key) {
+			sp->hs_ep = ep;
+			return 0;
+		}
+	}
+	if (free_sp == NULL) {
+		free_sp = sp;
+		hp->sh_used++;
+	}
+	free_sp->hs_key = key;
+	free_sp->hs_ep = ep;
+	hp->sh_count++;
+	return 0;
+}
+
+/** sa_hash_remove(hp, key) - remove an entry.
+ *
+ * @param hp pointer to sa_hash structure.
+ * @param key the key for the entry.
+ * @returns the entry removed, or NULL if there was none.
  */
 void *
-sa_table_search(struct sa_table *tp, void *(*match)(void *ep, void *arg),
-	void *arg)
+sa_hash_remove(struct sa_hash *hp, u_int64_t key)
 {
-	int i;
-	void *found = NULL;
+	struct sa_hash_slot *sp;
+	u_int32_t mask;
+	u_int32_t i;
 	void *ep;
 
-	for (i = 0; i < tp->st_limit; i++) {
-		ep = tp->st_table[i];
-		if (ep != NULL) {
-			found = (*match)(ep, arg);
-			if (found != NULL)
-				break;
-		}
+	if (hp->sh_count == 0)
+		return NULL;
+	mask = hp->sh_size - 1;
+	for (i = sa_hash_mix(key) & mask; ; i = (i + 1) & mask) {
+		sp = &hp->sh_slots[i];
+		if (sp->hs_ep == NULL)
+			return NULL;
+		if (sp->hs_key == key && sp->hs_ep != sa_hash_deleted)
+			break;
+	}
+	ep = sp->hs_ep;
+	sp->hs_ep = sa_hash_deleted;
+	hp->sh_count--;
+	return ep;
+}
+
+/** sa_hash_destroy(hp) - free memory used by a hash table.
+ *
+ * @param hp pointer to sa_hash structure.
+ *
+ * The entries themselves are not freed.
+ */
+void
+sa_hash_destroy(struct sa_hash *hp)
+{
+	free(hp->sh_slots);
+	sa_hash_init(hp);
+}
+
+/** sa_intern(ip, str) - add a string to an intern pool.
+ *
+ * @param ip pointer to sa_intern structure.
+ * @param str string to add.
+ * @returns handle for sa_intern_str(), or SA_INTERN_NONE on failure.
+ *
+ * Adding a string already in the pool returns the existing handle.
+ */
+u_int32_t
+sa_intern(struct sa_intern *ip, const char *str)
+{
+	u_int64_t key = sa_hash_string(str);
+	u_int32_t handle;
+	size_t len = strlen(str) + 1;
+	u_int32_t size;
+	char *buf;
+	void *ep;
+
+	ep = sa_hash_lookup(&ip->si_index, key);
+	if (ep != NULL) {
+		handle = (u_int32_t) ((uintptr_t) ep - 1);
+		if (strcmp(ip->si_buf + handle, str) == 0)
+			return handle;
+	}
+	if (len > UINT_MAX - 1 - ip->si_len)
+		return SA_INTERN_NONE;
+	if (ip->si_len + len > ip->si_size) {
+		size = ip->si_size ? ip->si_size : 256;
+		while (size < ip->si_len + len && size <= UINT_MAX / 2)
+			size *= 2;
+		if (size < ip->si_len + len)
+			size = ip->si_len + len;
+		buf = realloc(ip->si_buf, size);
+		if (buf == NULL)
+			return SA_INTERN_NONE;
+		ip->si_buf = buf;
+		ip->si_size = size;
 	}
-	return found;
+	handle = ip->si_len;
+	memcpy(ip->si_buf + handle, str, len);
+	ip->si_len += len;
+	if (ep == NULL)     /* on a hash collision, keep the first string */
+		sa_hash_insert(&ip->si_index, key,
+			       (void *) ((uintptr_t) handle + 1));
+	return handle;
+}
+
+/** sa_intern_destroy(ip) - free an intern pool.
+ *
+ * @param ip pointer to sa_intern structure.
+ */
+void
+sa_intern_destroy(struct sa_intern *ip)
+{
+	free(ip->si_buf);
+	sa_hash_destroy(&ip->si_index);
+	memset(ip, 0, sizeof(*ip));
 }
@@ -27,6 +27,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <errno.h>
@@ -57,9 +58,68 @@ struct sa_nameval {
 struct sa_table {
 	u_int32_t   st_size;        /* number of entries in table */
 	u_int32_t   st_limit;       /* end of valid entries in table (public) */
+	u_int32_t   st_count;       /* number of non-NULL entries (public) */
 	void        **st_table;     /* re-allocatable array of pointers */
 };
 
+/*
+ * Loop over the non-NULL entries of a table.
+ * Usage:  sa_table_foreach(tp, i, ep) { ... }
+ * The index i and entry pointer ep are lvalues supplied by the caller.
+ * The table must not be grown by the loop body.
+ */
+#define sa_table_foreach(tp, i, ep)					\
+	for ((i) = 0; (i) < (tp)->st_limit; (i)++)			\
+		if (((ep) = (tp)->st_table[i]) == NULL) {		\
+		} else
+
+/*
+ * Structure for hash tables mapping 64-bit keys to entries.
+ * Open addressing with linear probing; the slot count is a power of two.
+ */
+struct sa_hash_slot {
+	u_int64_t   hs_key;
+	void        *hs_ep;         /* NULL if empty */
+};
+
+struct sa_hash {
+	u_int32_t   sh_size;        /* number of slots, zero or a power of 2 */
+	u_int32_t   sh_count;       /* number of live entries */
+	u_int32_t   sh_used;        /* live entries plus deleted slots */
+	struct sa_hash_slot *sh_slots;
+};
+
+/*
+ * Structure for bump allocators.
+ * Memory is carved sequentially out of large chunks and is only
+ * released all at once, or back to a mark.
+ */
+struct sa_arena_chunk {
+	struct sa_arena_chunk *ac_next;     /* older chunk */
+	size_t      ac_base;        /* arena bytes in use before this chunk */
+	size_t      ac_size;        /* usable bytes in chunk */
+	size_t      ac_used;        /* bytes handed out from chunk */
+};
+
+struct sa_arena {
+	struct sa_arena_chunk *ar_chunks;   /* newest chunk first */
+	size_t      ar_in_use;      /* bytes handed out (public) */
+	size_t      ar_size;        /* bytes allocated from malloc (public) */
+};
+
+/*
+ * Structure for string intern pools.
+ * Each distinct string is stored once; users keep a 32-bit offset.
+ */
+struct sa_intern {
+	char        *si_buf;        /* NUL-terminated strings back to back */
+	u_int32_t   si_len;         /* bytes used in si_buf */
+	u_int32_t   si_size;        /* bytes allocated for si_buf */
+	struct sa_hash si_index;    /* string hash to offset + 1 */
+};
+
+#define SA_INTERN_NONE  (~(u_int32_t) 0)    /* failed intern */
+
 /*
  * Function prototypes
  */
@@ -77,12 +137,18 @@ extern int sa_enum_encode(const struct sa_nameval *tp,
 extern const char *sa_flags_decode(char *, size_t,
 				   const struct sa_nameval *, u_int32_t);
 extern int sa_table_grow(struct sa_table *, u_int32_t index);
+extern int sa_table_reserve(struct sa_table *, u_int32_t size);
+extern void sa_table_compact(struct sa_table *);
 extern void sa_table_destroy_all(struct sa_table *);
 extern void sa_table_destroy(struct sa_table *);
-extern void sa_table_iterate(struct sa_table *tp,
-			void (*handler)(void *ep, void *arg), void *arg);
-extern void *sa_table_search(struct sa_table *tp,
-			void *(*match)(void *ep, void *arg), void *arg);
+extern void *sa_arena_alloc(struct sa_arena *, size_t);
+extern void sa_arena_unwind(struct sa_arena *, size_t mark);
+extern void sa_arena_release(struct sa_arena *);
+extern u_int32_t sa_intern(struct sa_intern *, const char *);
+extern void sa_intern_destroy(struct sa_intern *);
+extern int sa_hash_insert(struct sa_hash *, u_int64_t key, void *ep);
+extern void *sa_hash_remove(struct sa_hash *, u_int64_t key);
+extern void sa_hash_destroy(struct sa_hash *);
 
 /** sa_table_init(tp) - initialize a table.
  * @param tp table pointer.
@@ -108,24 +174,6 @@ static inline void *sa_table_lookup(const struct sa_table *tp, u_int32_t index)
 	return ep;
 }
 
-/** sa_table_lookup_n(tp, n) - find Nth non-empty entry in a table.
- * @param tp table pointer.
- * @param n is the entry number, the first non-empty entry is 0.
- * @returns the entry, or NULL if the end of the table reached first.
- */
-static inline void *sa_table_lookup_n(const struct sa_table *tp, u_int32_t n)
-{
-	void *ep = NULL;
-	u_int32_t   i;
-
-	for (i = 0; i < tp->st_limit; i++) {
-		ep = tp->st_table[i];
-		if (ep != NULL && n-- == 0)
-			return ep;
-	}
-	return NULL;
-}
-
 /** sa_table_insert(tp, index, ep) - Replace or insert an entry in the table.
  * @param tp table pointer.
  * @param index the index for the new entry.
@@ -143,10 +191,45 @@ static inline int sa_table_insert(struct sa_table *tp,
 {
 	if (index >= tp->st_limit && sa_table_grow(tp, index) < 0)
 		return -1;
+	if (tp->st_table[index] == NULL) {
+		if (ep != NULL)
+			tp->st_count++;
+	} else if (ep == NULL)
+		tp->st_count--;
 	tp->st_table[index] = ep;
 	return index;
 }
 
+/** sa_table_remove(tp, index) - clear an entry in the table.
+ * @param tp table pointer.
+ * @param index the index of the entry.
+ * @returns the entry removed, or NULL if there was none.
+ *
+ * The slot is left empty; indexes of other entries don't change.
+ */
+static inline void *sa_table_remove(struct sa_table *tp, u_int32_t index)
+{
+	void *ep;
+
+	ep = sa_table_lookup(tp, index);
+	if (ep != NULL) {
+		tp->st_table[index] = NULL;
+		tp->st_count--;
+	}
+	return ep;
+}
+
+/** sa_table_clear(tp) - remove all entries, keeping the allocation.
+ * @param tp table pointer.
+ */
+static inline void sa_table_clear(struct sa_table *tp)
+{
+	if (tp->st_table)
+		memset(tp->st_table, 0, tp->st_limit * sizeof(void *));
+	tp->st_limit = 0;
+	tp->st_count = 0;
+}
+
 /** sa_table_append(tp, ep) - add entry to table and return index.
  *
  * @param tp pointer to sa_table structure.
@@ -161,6 +244,48 @@ sa_table_append(struct sa_table *tp, void *ep)
 	return sa_table_insert(tp, tp->st_limit, ep);
 }
 
+/** sa_table_iterate(tp, handler, arg)
+ *
+ * @param tp pointer to sa_table structure.
+ * @param handler function to be called for each non-NULL entry.
+ * @param arg argument for function.
+ *
+ * This is inline so that a constant handler can be inlined as well.
+ */
+static inline void
+sa_table_iterate(struct sa_table *tp,
+		 void (*handler)(void *ep, void *arg), void *arg)
+{
+	u_int32_t i;
+	void *ep;
+
+	sa_table_foreach(tp, i, ep)
+		(*handler)(ep, arg);
+}
+
+/** sa_table_pop(tp) - remove and return the last entry.
+ *
+ * @param tp pointer to sa_table structure.
+ * @returns the entry, or NULL if the table is empty.
+ *
+ * With sa_table_append() this lets a table be used as a stack.
+ */
+static inline void *
+sa_table_pop(struct sa_table *tp)
+{
+	void *ep;
+
+	while (tp->st_limit > 0) {
+		ep = tp->st_table[--tp->st_limit];
+		if (ep != NULL) {
+			tp->st_table[tp->st_limit] = NULL;
+			tp->st_count--;
+			return ep;
+		}
+	}
+	return NULL;
+}
+
 /** sa_table_sort(tp, compare) - sort table in place
  *
  * @param tp pointer to sa_table structure.
@@ -174,4 +299,123 @@ sa_table_sort(struct sa_table *tp, int (*compare)(const void **, const void **))
 		(int (*)(const void *, const void *)) compare);
 }
 
+/** sa_arena_init(arp) - initialize an arena.
+ * @param arp arena pointer.
+ *
+ * An all-zero arena is empty and valid.
+ */
+static inline void sa_arena_init(struct sa_arena *arp)
+{
+	memset(arp, 0, sizeof(*arp));
+}
+
+/** sa_arena_mark(arp) - remember the current allocation point.
+ * @param arp arena pointer.
+ * @returns a mark for sa_arena_unwind().
+ */
+static inline size_t sa_arena_mark(const struct sa_arena *arp)
+{
+	return arp->ar_in_use;
+}
+
+/*
+ * Marker for deleted hash slots.  Never returned as an entry.
+ */
+extern char sa_hash_deleted[];
+
+/*
+ * Loop over the entries of a hash table, in no particular order.
+ * Usage:  sa_hash_foreach(hp, i, ep) { ... }
+ * The slot index i and entry pointer ep are lvalues supplied by the caller.
+ * Entries may be removed, but not inserted, by the loop body.
+ */
+#define sa_hash_foreach(hp, i, ep)					\
+	for ((i) = 0; (i) < (hp)->sh_size; (i)++)			\
+		if (((ep) = (hp)->sh_slots[i].hs_ep) == NULL ||		\
+		    (void *) (ep) == (void *) sa_hash_deleted) {	\
+		} else
+
+/** sa_hash_init(hp) - initialize a hash table.
+ * @param hp hash table pointer.
+ *
+ * An all-zero hash table is empty and valid.
+ */
+static inline void sa_hash_init(struct sa_hash *hp)
+{
+	memset(hp, 0, sizeof(*hp));
+}
+
+/** sa_hash_mix(key) - scramble a key into a slot hash.
+ * @param key the key.
+ * @returns a well-distributed 32-bit hash of the key.
+ *
+ * Keys like FC_IDs and target numbers are dense in their low bits,
+ * WWNs share their high bits, so fold everything together.
+ */
+static inline u_int32_t sa_hash_mix(u_int64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return (u_int32_t) key;
+}
+
+/** sa_hash_string(str) - compute a 64-bit key for a string.
+ * @param str NUL-terminated string.
+ * @returns FNV-1a hash of the string.
+ *
+ * Different strings may produce the same key, so callers that index
+ * strings must compare the string of the entry found.
+ */
+static inline u_int64_t sa_hash_string(const char *str)
+{
+	u_int64_t key = 0xcbf29ce484222325ULL;
+
+	while (*str != '\0') {
+		key ^= (u_char) *str++;
+		key *= 0x100000001b3ULL;
+	}
+	return key;
+}
+
+/** sa_hash_lookup(hp, key) - find an entry by key.
+ * @param hp hash table pointer.
+ * @param key the key to look for.
+ * @returns the entry, or NULL if not present.
+ */
+static inline void *sa_hash_lookup(const struct sa_hash *hp, u_int64_t key)
+{
+	struct sa_hash_slot *sp;
+	u_int32_t mask;
+	u_int32_t i;
+
+	if (hp->sh_count == 0)
+		return NULL;
+	mask = hp->sh_size - 1;
+	for (i = sa_hash_mix(key) & mask; ; i = (i + 1) & mask) {
+		sp = &hp->sh_slots[i];
+		if (sp->hs_ep == NULL)
+			return NULL;
+		if (sp->hs_key == key && sp->hs_ep != sa_hash_deleted)
+			return sp->hs_ep;
+	}
+}
+
+/** sa_intern_str(ip, handle) - get an interned string.
+ * @param ip intern pool pointer.
+ * @param handle value returned by sa_intern().
+ * @returns the string, or "" for SA_INTERN_NONE.
+ *
+ * The pointer is only good until the next sa_intern() on the pool.
+ */
+static inline const char *sa_intern_str(const struct sa_intern *ip,
+					u_int32_t handle)
+{
+	if (handle == SA_INTERN_NONE || handle >= ip->si_len)
+		return "";
+	return ip->si_buf + handle;
+}
+
 #endif /* _UTILS_H_ */
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2008, Intel Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Cache warm-up.
+ *
+ * When HBALINUX_WARMUP is set, a low-priority thread started at load
+ * reads ahead what the first library calls would otherwise read: the
+ * discovered ports, and the device names, LUIDs and standard INQUIRY
+ * data of the SCSI devices of each FC host.  It only reads; what it
+ * read is taken into the caches by the next library call using them.
+ * The thread is stopped, between SCSI devices, when the library is freed.
+ */
+
+#include "utils.h"
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "api_lib.h"
+#include "adapt_impl.h"
+#include "bind_impl.h"
+#include "hbalinux.h"
+#include "warm_impl.h"
+
+/*
+ * Keys of the SCSI devices to read, by binding_warm_find().
+ */
+struct warm_luns {
+	u_int64_t       *wl_keys;
+	u_int32_t       wl_count;
+};
+
+static pthread_mutex_t warm_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hbalinux_warmup warm_status;      /* under warm_lock */
+static volatile int warm_cancel;
+static pthread_t warm_thread;
+static int warm_running;
+
+/*
+ * Add the SCSI devices of an FC host to the list to read.
+ */
+static int
+warm_find_host(struct dirent *dp, void *arg)
+{
+	struct warm_luns *lp = arg;
+	u_int64_t *keys;
+	u_int64_t *all;
+	u_int32_t count;
+	u_int32_t hba;
+
+	if (sscanf(dp->d_name, "host%u", &hba) != 1)
+		return 0;
+	count = binding_warm_find(hba, &keys);
+	if (count == 0) {
+		free(keys);
+		return 0;
+	}
+	all = realloc(lp->wl_keys, (lp->wl_count + count) * sizeof(*all));
+	if (all == NULL) {
+		free(keys);
+		return 0;
+	}
+	memcpy(all + lp->wl_count, keys, count * sizeof(*all));
+	free(keys);
+	lp->wl_keys = all;
+	lp->wl_count += count;
+	pthread_mutex_lock(&warm_lock);
+	warm_status.LunsFound = lp->wl_count;
+	pthread_mutex_unlock(&warm_lock);
+	return 0;
+}
+
+/*
+ * Run the warm-up at idle priority, so it only uses CPU time nothing
+ * else wants.  Failing that, it runs at the lowest nice value.
+ */
+static void
+warm_lower_priority(void)
+{
+	struct sched_param param;
+
+	memset(&param, 0, sizeof(param));
+	if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+		setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+}
+
+static void *
+warm_run(void *arg)
+{
+	struct warm_luns luns;
+	u_int32_t count;
+	u_int32_t i;
+
+	warm_lower_priority();
+	count = rport_prefetch();
+	pthread_mutex_lock(&warm_lock);
+	warm_status.RportsRead = count;
+	pthread_mutex_unlock(&warm_lock);
+
+	memset(&luns, 0, sizeof(luns));
+	if (!warm_cancel)
+		sa_dir_read(SYSFS_HOST_DIR, warm_find_host, &luns);
+	for (i = 0; i < luns.wl_count && !warm_cancel; i++) {
+		binding_warm_lun(luns.wl_keys[i]);
+		pthread_mutex_lock(&warm_lock);
+		warm_status.LunsRead++;
+		pthread_mutex_unlock(&warm_lock);
+	}
+	free(luns.wl_keys);
+
+	pthread_mutex_lock(&warm_lock);
+	warm_status.State = warm_cancel ? HBALINUX_WARMUP_CANCELLED :
+		HBALINUX_WARMUP_DONE;
+	pthread_mutex_unlock(&warm_lock);
+	return NULL;
+}
+
+/*
+ * Start the warm-up thread if HBALINUX_WARMUP is set to non-zero.
+ */
+void
+warm_start(void)
+{
+	const char *env;
+
+	env = getenv("HBALINUX_WARMUP");
+	if (warm_running || env == NULL || strtol(env, NULL, 0) == 0)
+		return;
+	memset(&warm_status, 0, sizeof(warm_status));
+	warm_status.State = HBALINUX_WARMUP_RUNNING;
+	warm_cancel = 0;
+	if (pthread_create(&warm_thread, NULL, warm_run, NULL) != 0) {
+		fprintf(stderr, "%s: thread create failed\n", __func__);
+		warm_status.State = HBALINUX_WARMUP_OFF;
+		return;
+	}
+	warm_running = 1;
+}
+
+/*
+ * Stop the warm-up thread.  A SCSI device being read is finished first.
+ */
+void
+warm_stop(void)
+{
+	if (!warm_running)
+		return;
+	warm_cancel = 1;
+	pthread_join(warm_thread, NULL);
+	warm_running = 0;
+}
+
+/*
+ * Report the progress of the warm-up.
+ */
+HBA_STATUS
+hbalinux_get_warmup(struct hbalinux_warmup *wp)
+{
+	pthread_mutex_lock(&warm_lock);
+	*wp = warm_status;
+	pthread_mutex_unlock(&warm_lock);
+	return HBA_STATUS_OK;
+}